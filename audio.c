@@ -7,8 +7,33 @@
 #include <stdio.h>
 #include "pico/stdlib.h"
 #include "pico/audio_i2s.h"
+#include "hardware/irq.h"
 
 #include "audio.h"
+#include "telemetry.h"
+#ifdef TETRACHORDER_LATENCY_PROBE
+#include "latency.h"
+#endif
+
+
+// buffer geometry: the pool is allocated once with the largest geometry, and a smaller geometry is obtained by
+// putting buffers aside (they are never given to the audio output) and by filling only the first samples of each buffer
+static uint32_t buffer_count = AUDIO_BUFFER_COUNT;          // number of buffers used, up to AUDIO_MAX_BUFFERS
+static uint32_t buffer_samples = AUDIO_BUFFER_SAMPLES;      // samples per buffer, up to SAMPLES_PER_BUFFER
+static struct audio_buffer *held_buffers[AUDIO_MAX_BUFFERS];
+static uint32_t held_count = 0;                             // number of buffers put aside
+
+// geometry requested by another core (count << 16 | samples), applied by the render core before it takes a buffer
+// written by the requesting core only: the render core applies it when it differs from the last one it applied
+static volatile uint32_t requested_geometry = 0;
+static uint32_t applied_geometry = 0;
+
+// buffers given to the output, and given back free by the output (when they start playing): the difference is the
+// number of buffers waiting to be played; all the buffers are free at start, and are taken once before any comes back
+static uint32_t given_count = 0;
+static uint32_t returned_count = 0;
+static uint32_t first_takes = 0;
+
 
 struct audio_buffer_pool *init_audio() {
 
@@ -23,7 +48,7 @@ struct audio_buffer_pool *init_audio() {
         .sample_stride = 2
     };
 
-    struct audio_buffer_pool *producer_pool = audio_new_producer_pool(&producer_format, 3, SAMPLES_PER_BUFFER);
+    struct audio_buffer_pool *producer_pool = audio_new_producer_pool(&producer_format, AUDIO_MAX_BUFFERS, SAMPLES_PER_BUFFER);
     bool __unused ok;
     const struct audio_format *output_format;
 
@@ -47,13 +72,138 @@ struct audio_buffer_pool *init_audio() {
 }
 
 
-void update_buffer(struct audio_buffer_pool *ap, buffer_callback cb) {
+// set the number of buffers (2 to AUDIO_MAX_BUFFERS) and the number of samples per buffer (AUDIO_MIN_SAMPLES to
+// SAMPLES_PER_BUFFER) while audio is running: fewer buffers and shorter buffers mean less latency, but less time to
+// render a buffer before the output runs out of samples
+// to be called on the core which renders audio, with interrupts disabled if buffers are rendered in the audio interrupt
+void set_audio_buffers(uint32_t count, uint32_t samples) {
+
+    buffer_count = MAX(2, MIN(count, AUDIO_MAX_BUFFERS));
+    buffer_samples = MAX(AUDIO_MIN_SAMPLES, MIN(samples, SAMPLES_PER_BUFFER));
+    telemetry_reset();                          // counters and measures are for one geometry
+#ifdef TETRACHORDER_LATENCY_PROBE
+    latency_reset();
+#endif
+}
+
+// ask the render core to change the buffer geometry (see set_audio_buffers()): to be called from any core, eg. core0
+// on a USB MIDI SysEx request; the geometry changes before the next buffer is rendered
+void request_audio_buffers(uint32_t count, uint32_t samples) {
+
+    requested_geometry = (MIN(count, 0xFFFF) << 16) | MIN(samples, 0xFFFF);
+}
+
+// apply the geometry requested by another core, if it changed (render core)
+static void apply_requested_buffers() {
+
+    uint32_t geometry = requested_geometry;
+    if (geometry == applied_geometry) return;
+    applied_geometry = geometry;
+    set_audio_buffers(geometry >> 16, geometry & 0xFFFF);
+}
+
+void get_audio_buffers(uint32_t *count, uint32_t *samples) {
+
+    *count = buffer_count;
+    *samples = buffer_samples;
+}
+
+
+// get a free buffer, or NULL if none is free and block is false
+// the number of buffers in use follows buffer_count: buffers are put aside when they come back free, or used again
+static struct audio_buffer *take_buffer(struct audio_buffer_pool *ap, bool block) {
+
+    struct audio_buffer *buffer;
+
+    apply_requested_buffers();
+
+    // buffer count has been increased: use buffers put aside first
+    if (held_count > AUDIO_MAX_BUFFERS - buffer_count) return held_buffers[--held_count];
+
+    while ((buffer = take_audio_buffer(ap, block)) != NULL) {
+        if (first_takes < AUDIO_MAX_BUFFERS) first_takes++;
+        else returned_count++;
+#ifdef TETRACHORDER_LATENCY_PROBE
+        latency_buffer_played(buffer);          // a buffer comes back free when it starts playing
+#endif
+        if (held_count >= AUDIO_MAX_BUFFERS - buffer_count) return buffer;
+        held_buffers[held_count++] = buffer;    // buffer count has been decreased: put the buffer aside
+    }
+    return NULL;
+}
+
+
+// fill a buffer with one call to the block callback, and queue it for playing
+static void render_buffer(struct audio_buffer_pool *ap, struct audio_buffer *buffer, block_callback cb) {
+
+    int16_t *samples = (int16_t *) buffer->buffer->bytes;
+    uint32_t start = time_us_32();
+    cb(samples, buffer_samples);                // the whole buffer is rendered in one call
+    telemetry_block(time_us_32() - start, buffer_samples, given_count - returned_count);
+    buffer->sample_count = buffer_samples;
+#ifdef TETRACHORDER_LATENCY_PROBE
+    latency_buffer_rendered(buffer, samples, buffer_samples);
+#endif
+    given_count++;
+    give_audio_buffer(ap, buffer);
+}
+
+
+void update_buffer(struct audio_buffer_pool *ap, block_callback cb) {
+
+    render_buffer(ap, take_buffer(ap, true), cb);
+}
+
+
+#if AUDIO_IRQ_RENDER
+static struct audio_buffer_pool *irq_pool;
+static block_callback irq_callback;
+
+// render all the free buffers, without waiting
+static void render_free_buffers() {
+
+    struct audio_buffer *buffer;
+    while ((buffer = take_buffer(irq_pool, false)) != NULL) {
+        render_buffer(irq_pool, buffer, irq_callback);
+    }
+}
+
+
+// called on the audio DMA interrupt, after the pico_audio_i2s handler has started playing the next buffer, and has
+// given it back to the pool: if no buffer came back, the output had nothing to play and started playing silence
+static void audio_dma_irq_handler() {
+
+    uint32_t returned = returned_count;
+    render_free_buffers();
+    if (returned_count == returned) telemetry_underrun();
+}
+
+
+// from now on, buffers are rendered in the audio DMA interrupt of the calling core (the core which called init_audio())
+// the DMA keeps running (it plays silence when no buffer is ready), so the interrupt fires once per buffer
+void start_audio_irq(struct audio_buffer_pool *ap, block_callback cb) {
+
+    irq_pool = ap;
+    irq_callback = cb;
+
+    // our handler has the lowest order priority, so it runs after the pico_audio_i2s handler
+    irq_set_enabled(DMA_IRQ_0 + PICO_AUDIO_I2S_DMA_IRQ, false);
+    irq_add_shared_handler(DMA_IRQ_0 + PICO_AUDIO_I2S_DMA_IRQ, audio_dma_irq_handler, PICO_SHARED_IRQ_HANDLER_LOWEST_ORDER_PRIORITY);
+    render_free_buffers();                      // fill the free buffers right now
+    irq_set_enabled(DMA_IRQ_0 + PICO_AUDIO_I2S_DMA_IRQ, true);
+}
+#endif
+
+
+// compatibility shim: fill the buffer by calling a per-sample callback for each sample
+void update_buffer_per_sample(struct audio_buffer_pool *ap, buffer_callback cb) {
 
-    struct audio_buffer *buffer = take_audio_buffer(ap, true);
+    struct audio_buffer *buffer = take_buffer(ap, true);
     int16_t *samples = (int16_t *) buffer->buffer->bytes;
-    for (uint32_t i = 0; i < buffer->max_sample_count; i++) {
+    for (uint32_t i = 0; i < buffer_samples; i++) {
         samples[i] = cb();
     }
-    buffer->sample_count = buffer->max_sample_count;
+    buffer->sample_count = buffer_samples;
+    given_count++;
     give_audio_buffer(ap, buffer);
 }
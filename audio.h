@@ -15,13 +15,44 @@
 #define PICO_AUDIO_I2S_DATA		9
 #define PICO_AUDIO_I2S_BCLK		10
 #define PICO_AUDIO_I2S_LRCLK	11
-#define SAMPLES_PER_BUFFER		256
+#define SAMPLES_PER_BUFFER		256		// largest buffer size (samples)
+#define AUDIO_MIN_SAMPLES		32		// smallest buffer size (samples)
+#define AUDIO_MAX_BUFFERS		4		// largest number of buffers
+
+// buffer geometry at start (cmake -DAUDIO_BUFFER_COUNT=n -DAUDIO_BUFFER_SAMPLES=n); it can be changed while audio is
+// running with request_audio_buffers() (USB MIDI SysEx, see telemetry.h), which core1 applies with set_audio_buffers()
+#ifndef AUDIO_BUFFER_COUNT
+#define AUDIO_BUFFER_COUNT		3
+#endif
+#ifndef AUDIO_BUFFER_SAMPLES
+#define AUDIO_BUFFER_SAMPLES	SAMPLES_PER_BUFFER
+#endif
+#if (AUDIO_BUFFER_COUNT < 2) || (AUDIO_BUFFER_COUNT > AUDIO_MAX_BUFFERS)
+#error "AUDIO_BUFFER_COUNT shall be 2 to AUDIO_MAX_BUFFERS"
+#endif
+#if (AUDIO_BUFFER_SAMPLES < AUDIO_MIN_SAMPLES) || (AUDIO_BUFFER_SAMPLES > SAMPLES_PER_BUFFER)
+#error "AUDIO_BUFFER_SAMPLES shall be AUDIO_MIN_SAMPLES to SAMPLES_PER_BUFFER"
+#endif
 #define SAMPLE_RATE				44100
 #define VOLUME					0xFFFF
 
-typedef int16_t (*buffer_callback)(void);
+// 1: buffers are rendered in the audio DMA interrupt, which also plays the chord changes at their frame; core1 sleeps otherwise
+// 0: core1 loop waits for a free buffer (update_buffer()), and renders it the same way
+#ifndef AUDIO_IRQ_RENDER
+#define AUDIO_IRQ_RENDER		1
+#endif
+
+typedef int16_t (*buffer_callback)(void);                   // per-sample callback (legacy)
+typedef void (*block_callback)(int16_t *, uint32_t);        // block callback: fills n samples at once
 
 struct audio_buffer_pool *init_audio();
-void update_buffer(struct audio_buffer_pool *ap, buffer_callback cb);
+void set_audio_buffers(uint32_t count, uint32_t samples);
+void request_audio_buffers(uint32_t count, uint32_t samples);
+void get_audio_buffers(uint32_t *count, uint32_t *samples);
+void update_buffer(struct audio_buffer_pool *ap, block_callback cb);
+void update_buffer_per_sample(struct audio_buffer_pool *ap, buffer_callback cb);
+#if AUDIO_IRQ_RENDER
+void start_audio_irq(struct audio_buffer_pool *ap, block_callback cb);
+#endif
 
 #endif // AUDIO_H
@@ -0,0 +1,220 @@
+#include "pico/stdlib.h"
+#include <stdint.h>
+#include <stdio.h>
+#ifdef TETRACHORDER_HOST
+#include <time.h>
+#else
+#include "hardware/structs/systick.h"
+#endif
+
+#include "globals.h"
+#include "audio.h"
+#include "synth.h"
+#include "play.h"
+#include "bench.h"
+
+
+static int16_t bench_buffer[SAMPLES_PER_BUFFER];
+
+
+#ifdef TETRACHORDER_HOST
+#define BENCH_UNIT "ns"
+
+static void start_cycle_counter() {
+}
+
+// ns from the monotonic clock, wrapping at 32 bits
+static uint32_t read_counter() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t) ((uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec);
+}
+
+// ns elapsed since a previous read of the counter
+static uint32_t cycles_since(uint32_t start) {
+    return read_counter() - start;
+}
+#else
+#define BENCH_UNIT "cycles"
+
+// start SysTick as a free-running 24-bit down counter on the processor clock
+static void start_cycle_counter() {
+    systick_hw->csr = 0;
+    systick_hw->rvr = 0x00FFFFFF;
+    systick_hw->cvr = 0;
+    systick_hw->csr = 0x5;        // enable, processor clock, no interrupt
+}
+
+static uint32_t read_counter() {
+    return systick_hw->cvr;
+}
+
+// cycles elapsed since a previous read of the counter (a block takes much less than 2^24 cycles)
+static uint32_t cycles_since(uint32_t start) {
+    return (start - systick_hw->cvr) & 0x00FFFFFF;
+}
+#endif
+
+
+// render 16 voices spread over 4 instruments and 4 octaves, reading waveforms from flash then from SRAM
+// the 4 instruments fit in the SRAM slots of play.c, so in the SRAM case no channel falls back to flash
+void bench_wavetables() {
+    int former_instr = channels[0].waveforms;
+
+    start_cycle_counter();
+
+    for (int in_ram = 0; in_ram < 2; in_ram++) {
+        uint32_t min = 0xFFFFFFFF, max = 0, total = 0;
+
+        reset_playback_all();
+        set_wavetables_in_ram(in_ram);
+        for (int c = 0; c < CHANNEL_COUNT; c++) {
+            load_instrument(c % 4, c);
+            update_playback(c, 36 + 12 * (c / 4) + (c % 4) * 3, false);
+        }
+        while (load_wavetables());      // copies made by core1 outside the audio interrupt
+
+        for (int b = 0; b < BENCH_BLOCKS; b++) {
+            uint32_t start = read_counter();
+            render_audio_block(bench_buffer, SAMPLES_PER_BUFFER);
+            uint32_t cycles = cycles_since(start);
+            if (cycles < min) min = cycles;
+            if (cycles > max) max = cycles;
+            total += cycles;
+        }
+
+        printf("bench: waveforms in %s, %d voices: %lu " BENCH_UNIT " per block (min %lu, max %lu), %lu per sample\n",
+            in_ram ? "SRAM" : "flash", CHANNEL_COUNT, (unsigned long) (total / BENCH_BLOCKS),
+            (unsigned long) min, (unsigned long) max, (unsigned long) (total / BENCH_BLOCKS / SAMPLES_PER_BUFFER));
+    }
+
+    // back to the state before the benchmark
+    reset_playback_all();
+    set_wavetables_in_ram(true);
+    instrument_task(former_instr);
+}
+
+
+static const uint8_t suite_voices[] = { 1, 4, 8, 16 };
+static const char *const suite_phases[] = { "attack", "decay", "sustain", "release" };
+
+// put the first voices channels back at the start of an ADSR phase, from the volume the phase normally starts from,
+// so that every block of a measure is rendered in this phase (the shortest phase of an instrument is longer than a block)
+static void enter_phase(int voices, ADSRPhase phase) {
+    for (int c = 0; c < voices; c++) {
+        AudioChannel *channel = &channels[c];
+
+        switch (phase) {
+            case ADSR_ATTACK:
+                trigger_attack(channel);
+                break;
+            case ADSR_DECAY:
+                channel->adsr = 0xffffff;
+                trigger_decay(channel);
+                break;
+            case ADSR_SUSTAIN:
+                channel->adsr = (uint32_t) channel->sustain << 8;
+                trigger_sustain(channel);
+                break;
+            default:
+                channel->adsr = 0xffffff;
+                trigger_release(channel);
+                break;
+        }
+    }
+}
+
+// render blocks for each instrument, with 1, 4, 8 and 16 voices, in each ADSR phase; one CSV line per measure, with
+// the mean time per sample and the shortest and longest blocks, so results can be compared between firmware versions
+void bench_synth() {
+    int former_instr = channels[0].waveforms;
+
+    start_cycle_counter();
+    printf("instrument,voices,phase,samples," BENCH_UNIT "_per_sample,min_" BENCH_UNIT "_per_block,max_" BENCH_UNIT "_per_block\n");
+
+    for (int instr = 0; instr < get_instrument_count(); instr++) {
+        for (int v = 0; v < (int) count_of(suite_voices); v++) {
+            int voices = suite_voices[v];
+
+            // voices spread over 4 octaves, as in a chord with its bass
+            reset_playback_all();
+            for (int c = 0; c < voices; c++) {
+                load_instrument(instr, c);
+                update_playback(c, 36 + 12 * (c / 4) + (c % 4) * 3, false);
+            }
+
+            for (int phase = ADSR_ATTACK; phase <= ADSR_RELEASE; phase++) {
+                uint32_t min = 0xFFFFFFFF, max = 0;
+                uint64_t total = 0;
+
+                for (int b = 0; b < BENCH_SUITE_BLOCKS; b++) {
+                    enter_phase(voices, (ADSRPhase) phase);
+                    uint32_t start = read_counter();
+                    render_audio_block(bench_buffer, SAMPLES_PER_BUFFER);
+                    uint32_t cycles = cycles_since(start);
+                    if (cycles < min) min = cycles;
+                    if (cycles > max) max = cycles;
+                    total += cycles;
+                }
+
+                printf("%d,%d,%s,%d,%.2f,%lu,%lu\n", instr, voices, suite_phases[phase],
+                    BENCH_SUITE_BLOCKS * SAMPLES_PER_BUFFER, (double) total / (BENCH_SUITE_BLOCKS * SAMPLES_PER_BUFFER),
+                    (unsigned long) min, (unsigned long) max);
+            }
+        }
+    }
+
+    // back to the state before the benchmark
+    reset_playback_all();
+    instrument_task(former_instr);
+}
+
+
+#if defined(TETRACHORDER_BENCH) || defined(TETRACHORDER_HOST)
+static const char *const mix_paths[] = { "32-bit", "int64" };
+
+// A/B benchmark of the mix arithmetic: the same voices (first instrument, in sustain) are rendered with the 32-bit gains
+// of the firmware, then with the former 64-bit multiplies; one CSV line per path and number of voices
+void bench_mix_paths() {
+    int former_instr = channels[0].waveforms;
+
+    start_cycle_counter();
+    printf("mix,voices,samples," BENCH_UNIT "_per_sample,min_" BENCH_UNIT "_per_block,max_" BENCH_UNIT "_per_block\n");
+
+    for (int v = 0; v < (int) count_of(suite_voices); v++) {
+        int voices = suite_voices[v];
+
+        for (int path = MIX_32BIT; path <= MIX_INT64; path++) {
+            uint32_t min = 0xFFFFFFFF, max = 0;
+            uint64_t total = 0;
+
+            // same voice load for both paths: notes start again from the same state
+            reset_playback_all();
+            for (int c = 0; c < voices; c++) {
+                load_instrument(0, c);
+                update_playback(c, 36 + 12 * (c / 4) + (c % 4) * 3, false);
+            }
+            set_mix_path((MixPath) path);
+
+            for (int b = 0; b < BENCH_SUITE_BLOCKS; b++) {
+                enter_phase(voices, ADSR_SUSTAIN);
+                uint32_t start = read_counter();
+                render_audio_block(bench_buffer, SAMPLES_PER_BUFFER);
+                uint32_t cycles = cycles_since(start);
+                if (cycles < min) min = cycles;
+                if (cycles > max) max = cycles;
+                total += cycles;
+            }
+
+            printf("%s,%d,%d,%.2f,%lu,%lu\n", mix_paths[path], voices, BENCH_SUITE_BLOCKS * SAMPLES_PER_BUFFER,
+                (double) total / (BENCH_SUITE_BLOCKS * SAMPLES_PER_BUFFER), (unsigned long) min, (unsigned long) max);
+        }
+    }
+
+    // back to the state before the benchmark
+    set_mix_path(MIX_32BIT);
+    reset_playback_all();
+    instrument_task(former_instr);
+}
+#endif
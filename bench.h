@@ -0,0 +1,23 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "pico/stdlib.h"
+
+
+// Render benchmarks, built when TETRACHORDER_BENCH is defined (cmake -DTETRACHORDER_BENCH=ON), and in the host build
+// on the board, they run on core1 before audio starts, and print their results on UART; on the host, they are run by
+// tetrachorder_bench (host/bench_main.c), which prints on stdout
+//
+// on the board, time is counted in cycles with the SysTick timer of core1, clocked by the processor clock; on the host,
+// it is counted in ns with the monotonic clock
+
+#define BENCH_BLOCKS 256          // number of blocks rendered for each measure of bench_wavetables()
+#define BENCH_SUITE_BLOCKS 32     // number of blocks rendered for each measure of bench_synth() and bench_mix_paths()
+
+void bench_wavetables(void);
+void bench_synth(void);
+void bench_mix_paths(void);       // with TETRACHORDER_BENCH (and in the host build) only, like the mix path switch of synth.c
+
+#endif // BENCH_H
@@ -188,95 +188,110 @@ void set_11 (void *pointer) {	// 11th
 //                        mM     mM     1   3
 }
 
+// intervals of the chord bitmap, byte by byte: for each value of a byte, the intervals (0 to 7 from the first degree of
+// the byte) whose bits are set, in ascending order; built at boot by build_interval_table ()
+typedef struct {
+	uint8_t count;
+	uint8_t intervals [8];
+} interval_chunk_t;
+
+static interval_chunk_t interval_chunks [256];
+
+// midi note for each note of the chord (root - 1 + interval, from 0 to 34), and for each bass note (bass - 1, from 0 to
+// 11), for the current voicings; rebuilt only when the voicing changes, so the notes of a chord are just looked up
+static uint8_t voicing_map [35];
+static uint8_t bass_voicing_map [12];
+static int map_voicing = -1;
+static int map_voicing_bass = -1;
+
+
+// build the table of intervals for each value of a byte of the chord bitmap (bit 7 of the byte being the first degree)
+void build_interval_table () {
+
+	for (int value = 0; value < 256; value++) {
+		interval_chunks [value].count = 0;
+		for (int bit = 7; bit >= 0; bit--) {
+			if (value & (1 << bit)) interval_chunks [value].intervals [interval_chunks [value].count++] = 7 - bit;
+		}
+	}
+}
+
+
+// build a voicing map: the midi note of each note (C being 0), so that all the notes are contained in the range of 12 notes
+// starting at voicing; notes above the range (intervals of the 2nd octave) are moved down once only, as they always were
+static void build_voicing_map (uint8_t *map, int size, int voicing) {
+
+	int start_voicing = voicing % 12;
+	int end_voicing = start_voicing + 11;
+	int base = ((int) (voicing / 12)) * 12;				// voicing to be multiple of 12
+
+	for (int elt = 0; elt < size; elt++) {
+		int note = elt;
+		if (note < start_voicing) note += 12;
+		if (note > end_voicing) note -= 12;
+		note = note + base;								// add to final voicing: this is the "note" in the midi message
+
+		while (note > 127) note -= 12;					// final test to make sure we are within midi range
+		while (note < 0) note += 12;					// final test to make sure we are within midi range
+		map [elt] = (uint8_t) note;
+	}
+
+	if (map == voicing_map) map_voicing = voicing;
+	else map_voicing_bass = voicing;
+}
+
+
 // This function reads a chord, and returns the midi notes to be played for both the chord, and the bass if it exists
 // The midi notes that are returned are in line with the value of the voicing
 // ie. the chord is played in a way that all the notes of the chord are contained within a range of 12 notes, this range being configurable. Same for bass.
 // voicing and voicing_bass correspond to the start note of the voicing in midi, that is in (0,127) range
 // function uses a pointer to result, a table of bytes. Each byte will contain midi value of one note of the chord to be played, plus bass.
 // the table of bytes "result" shall be declared outside the function. It should be at least: R + 3 + 5 + 7 + 9 + 11 + bass = 7 bytes for a full (chord + bass)
-// function returns the number of midi notes to be sent (size of result to be considered)
+// function returns the number of midi notes to be sent (size of result to be considered): this is the note count, taken from
+// the count of the interval table for each byte of the bitmap, plus 1 for the bass; there is no separate count function
+// the notes of the chord are sorted in ascending order, and the bass (if any) is the last note
 int get_midi_notes (uint8_t *result, void *pointer, int voicing, int voicing_bass) {	// result should be allocated outside the function
 
 	chord_t *chord = (chord_t *)pointer;
 	int nb = 0;											// number of midi notes to return
+	int i, j, c;
 
 	// start with main chord first
 	if (chord->rootnote == 0) return 0;					// no chord available : exit
-	int start_voicing = voicing % 12;
-	int end_voicing = start_voicing + 11;
-	voicing = ((int) (voicing / 12)) * 12;				// voicing to be multiple of 12
-	
-	uint32_t ch = chord->bitmap;
-	int index = 0;
-		
-	// go through chord and retrieve all the notes to be played; C=1 C#=2 D=3 D#=4 E=5 F=6 F#=7 G=8 G#=9 A=10 A#=11 B=12
-	while (ch > 0) {
-		if ((ch & 0b100000000000000000000000) != 0) {			// test MSB
-			int elt = (chord->rootnote - 1) + index;			// note to be played (C being 1)
-
-			// now, make sure the chord is in the voicing
-			if (elt < start_voicing) elt += 12;
-			if (elt > end_voicing) elt -=12;	
-			elt = elt + voicing;								// add to final voicing: this is the "note" in the midi message
-
-			while (elt > 127) elt -= 12;						// final test to make sure we are within midi range
-			while (elt < 0) elt += 12;							// final test to make sure we are within midi range
-			result [nb++] = (uint8_t) elt;						// add midi note to the list of midi notes to be played
+	if (voicing != map_voicing) build_voicing_map (voicing_map, 35, voicing);	// only when voicing changes
+	const uint8_t *map = voicing_map + (chord->rootnote - 1);	// note for each interval from the root
+
+	// go through chord bitmap byte by byte, and retrieve the intervals to be played from the table
+	for (c = 0; c < 3; c++) {
+		const interval_chunk_t *chunk = &interval_chunks [(chord->bitmap >> (16 - (8 * c))) & 0xFF];
+		for (i = 0; i < chunk->count; i++) {
+			// keep notes sorted: insert the note among the former ones (a chord has a few notes)
+			uint8_t note = map [(8 * c) + chunk->intervals [i]];
+			for (j = nb; (j > 0) && (result [j - 1] > note); j--) result [j] = result [j - 1];
+			result [j] = note;
+			nb++;
 		}
-
-		ch = ch & 0b011111111111111111111111;					// shift to next degree
-		ch = ch << 1;
-		index += 1;
 	}
 
-	// manage bass
+	// manage bass: it is the last note
 	if (chord->bass == 0) return nb;							// no bass available : exit
-	int start_voicing_bass = voicing_bass % 12;
-	int end_voicing_bass = start_voicing_bass + 11;
-	voicing_bass = ((int) (voicing_bass / 12)) * 12;			// voicing_bass to be multiple of 12
-	
-	int elt = (chord->bass - 1);								// note to be played (C being 1)
-	// now, make sure the chord is in the voicing
-	if (elt < start_voicing_bass) elt += 12;
-	if (elt > end_voicing_bass) elt -=12;	
-	elt = elt + voicing_bass;									// add to final voicing: this is the "note" in the midi message
-
-	while (elt > 127) elt -= 12;								// final test to make sure we are within midi range
-	while (elt < 0) elt += 12;									// final test to make sure we are within midi range
-	result [nb++] = (uint8_t) elt;								// add midi note to the list of midi notes to be played
+	if (voicing_bass != map_voicing_bass) build_voicing_map (bass_voicing_map, 12, voicing_bass);
+	result [nb++] = bass_voicing_map [chord->bass - 1];
 
 	return nb;
 }
 
 
-// This function compares 2 lists of midi notes together (list A and B), and come out:
-// in case equal == false --> with a list of notes (res) that are in list A of midi notes but not in list B of midi notes.
-// in case equal == true --> with a list of notes (res) that are both in list A of midi notes and in list B of midi notes.
-// the 2 lists should be memory-allocated outside the function; they should be at least 7 bytes
-// It returns a new list of midi notes, as well the number of elements in this list 
-int cmp_midi_notes (uint8_t *listA, int sizeA, uint8_t *listB, int sizeB, bool equal, uint8_t *res) {
-
-	int i, j, nb = 0;											// nb = number of midi notes to return
-	bool found;
-	
-	for (i=0; i<sizeA; i++) {
-		found = false;
-		for (j=0; j<sizeB; j++) {
-			if (listA [i] == listB[j]) found = true;			// we have found the same element in the 2 lists
-		}
-		if (equal) {
-			if (found) {											// we have found the element that is in list A in list B
-				res [nb++] = listA [i];								// add this element to the result
-			}
-		}
-		else {
-			if (!found) {											// we haven't found the element that is in list A in list B
-				res [nb++] = listA [i];								// add this element to the result
-			}
-		}			
-	}
-	
-	return nb;													// return number of elements which are not common to both lists
+// Same as get_midi_notes (), but returns the midi notes of the chord and bass as a set of notes
+// notes common to 2 chords, notes to be played and notes to be released are then AND / AND NOT of the sets (see noteset.h)
+void get_midi_noteset (noteset_t *set, void *pointer, int voicing, int voicing_bass) {
+
+	uint8_t notes [25];									// 24 degrees + bass
+	int i, nb;
+
+	nb = get_midi_notes (notes, pointer, voicing, voicing_bass);
+	noteset_clear (set);
+	for (i = 0; i < nb; i++) noteset_add (set, notes [i]);
 }
 
 
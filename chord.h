@@ -2,6 +2,7 @@
 #define CHORD_H
 
 #include "pico/stdlib.h"
+#include "noteset.h"
 
 /***********************************/
 /* definition of a chord structure */
@@ -39,7 +40,8 @@ void reset_9 (void *);
 void set_9 (void *);
 void reset_11 (void *);
 void set_11 (void *);
+void build_interval_table ();
 int get_midi_notes (uint8_t *, void *, int , int );
-int cmp_midi_notes (uint8_t *, int , uint8_t *, int , bool , uint8_t *);
+void get_midi_noteset (noteset_t *, void *, int , int );
 
 #endif
\ No newline at end of file
@@ -0,0 +1,111 @@
+#include "pico/stdlib.h"
+#include <stdint.h>
+#include "hardware/sync.h"
+
+#include "globals.h"
+#include "event_ring.h"
+
+
+static ChordEvent ring[EVENT_RING_SIZE];
+static volatile uint32_t ring_head = 0;       // number of records published, written by core0 only
+static volatile uint32_t ring_tail = 0;       // number of records consumed, written by core1 only
+
+
+// core0: publish a record; returns false if the ring is full
+bool event_ring_push(const ChordEvent *event) {
+    uint32_t head = ring_head;
+
+    if (head - ring_tail >= EVENT_RING_SIZE) return false;
+    ring[head & (EVENT_RING_SIZE - 1)] = *event;
+    __mem_fence_release();                    // the record is written before it is published
+    ring_head = head + 1;
+    return true;
+}
+
+// core1: get the oldest record; returns false if the ring is empty
+bool event_ring_pop(ChordEvent *event) {
+    uint32_t tail = ring_tail;
+
+    if (tail == ring_head) return false;
+    __mem_fence_acquire();                    // the record is read after it has been published
+    *event = ring[tail & (EVENT_RING_SIZE - 1)];
+    __mem_fence_release();                    // the record is read before its slot is given back
+    ring_tail = tail + 1;
+    return true;
+}
+
+// core0: check whether a record can be published
+bool event_ring_is_full() {
+    return ring_head - ring_tail >= EVENT_RING_SIZE;
+}
+
+
+// empty record: no program change, no controller change, no notes
+void chord_event_init(ChordEvent *event) {
+    event->time = 0;
+    event->program = NO_PROGRAM;
+    event->controls = 0;
+    event->volume = NO_CONTROL;
+    event->bend = NO_CONTROL;
+    noteset_clear(&event->off);
+    noteset_clear(&event->on);
+}
+
+bool chord_event_is_empty(const ChordEvent *event) {
+    return (event->program == NO_PROGRAM) && !event->controls && (event->volume == NO_CONTROL) &&
+        (event->bend == NO_CONTROL) && noteset_is_empty(&event->off) && noteset_is_empty(&event->on);
+}
+
+// add a MIDI channel message to a record (the channel is not checked): note on (note off if velocity is 0), note off,
+// program change, pitch bend, and CC 7 (volume), 120 (all sound off), 121 (reset controllers: pitch bend) and
+// 123 (all notes off); other messages are ignored
+// the record is played in a fixed order (program, all off, notes off, notes on, pitch bend and volume), so a message
+// which would be played out of its order is not added, and false is returned: the caller publishes the record, and adds
+// the message to a new one; successive pitch bends or volumes in a record keep the last one
+bool chord_event_add_midi(ChordEvent *event, uint8_t status, uint8_t data1, uint8_t data2) {
+    bool notes = !noteset_is_empty(&event->off) || !noteset_is_empty(&event->on);
+
+    data1 &= 0x7F;
+    data2 &= 0x7F;
+    if (((status & 0xF0) == MIDI_NOTEON) && !data2) status = MIDI_NOTEOFF;  // velocity 0 is a note off
+    switch (status & 0xF0) {
+        case MIDI_NOTEON:
+            if (noteset_has(&event->on, data1)) return false;             // the former note on is retriggered
+            noteset_add(&event->on, data1);
+            break;
+        case MIDI_NOTEOFF:
+            if (noteset_has(&event->on, data1)) return false;             // the note is played before it is released
+            noteset_add(&event->off, data1);
+            break;
+        case MIDI_PGMCHANGE:
+            if (notes || event->controls || (event->volume != NO_CONTROL) || (event->bend != NO_CONTROL)) return false;
+            event->program = data1;
+            break;
+        case MIDI_PITCHBEND:
+            event->bend = (int16_t) ((data2 << 7) | data1);
+            break;
+        case MIDI_CC:
+            switch (data1) {
+                case 7:
+                    event->volume = (int8_t) data2;
+                    break;
+                case 120:
+                    if (notes) return false;
+                    event->controls |= EVENT_ALL_SOUND_OFF;
+                    break;
+                case 121:
+                    event->bend = 8192;
+                    break;
+                case 123:
+                    if (notes) return false;
+                    event->controls |= EVENT_ALL_NOTES_OFF;
+                    break;
+                default:
+                    break;
+            }
+            break;
+        default:
+            break;
+    }
+    return true;
+}
@@ -0,0 +1,46 @@
+#ifndef EVENT_RING_H
+#define EVENT_RING_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "pico/stdlib.h"
+#include "noteset.h"
+
+
+// Event ring between core0 (UI, single producer) and core1 (synth, single consumer)
+//
+// - a whole chord change (program change, notes off, notes on) is one record, so core1 applies it at once, at the start
+//   of a render block: the notes of a chord never straddle two buffers
+// - lock-free: each index is written by one core only, and memory barriers make sure a record is completely written
+//   before core1 can see it, and completely read before core0 can overwrite it
+// - records are timestamped by core0, and core1 applies them at the matching sample in the block it renders
+// - when the ring is full, the record is not published and the producer keeps its state, so it can try again later
+// - records come from the keyboard (chord changes) and from USB MIDI input (channel messages, see chord_event_add_midi())
+
+#define EVENT_RING_SIZE   16        // number of records, power of 2
+#define NO_PROGRAM        -1        // no program change in the record
+#define NO_CONTROL        -1        // no pitch bend or volume change in the record
+
+// changes applied after the program change, before the notes
+#define EVENT_ALL_SOUND_OFF     0x01    // all the channels are shut down at once (CC 120)
+#define EVENT_ALL_NOTES_OFF     0x02    // all the notes are released (CC 123)
+
+typedef struct {
+    uint64_t time;                  // time_us_64() when core0 published the record
+    int16_t program;                // program change, applied first, or NO_PROGRAM
+    uint8_t controls;               // EVENT_ALL_* changes
+    int8_t volume;                  // volume (0 to 127, CC 7), applied after the notes, or NO_CONTROL
+    int16_t bend;                   // pitch bend (0 to 16383, 8192 is center), applied after the notes, or NO_CONTROL
+    noteset_t off;                  // notes to be released
+    noteset_t on;                   // notes to be played
+} ChordEvent;
+
+bool event_ring_push(const ChordEvent *);
+bool event_ring_pop(ChordEvent *);
+bool event_ring_is_full(void);
+
+void chord_event_init(ChordEvent *);
+bool chord_event_is_empty(const ChordEvent *);
+bool chord_event_add_midi(ChordEvent *, uint8_t status, uint8_t data1, uint8_t data2);
+
+#endif // EVENT_RING_H
@@ -0,0 +1,20 @@
+#include <stdio.h>
+#include "pico/stdlib.h"
+
+#include "globals.h"
+#include "audio.h"
+#include "synth.h"
+#include "play.h"
+#include "bench.h"
+
+
+// Host render benchmarks: same measures as on the board (bench.c), in ns, as CSV on stdout
+//
+// tetrachorder_bench > bench.csv
+int main() {
+    set_audio_rate_and_volume(SAMPLE_RATE, VOLUME);
+    reset_playback_all();
+    bench_synth();
+    bench_mix_paths();
+    return 0;
+}
@@ -0,0 +1,206 @@
+#include <stdio.h>
+#include <time.h>
+#include "pico/stdlib.h"
+
+#include "globals.h"
+#include "audio.h"
+#include "synth.h"
+#include "play.h"
+#include "event_ring.h"
+#include "telemetry.h"
+
+
+// Chord change stress: a chord change every 20 ms of rendered audio, most of them retriggering notes which are still
+// sounding (in attack, decay, sustain or release), with enough notes for channels to be stolen
+//
+// blocks have the size of the audio buffers at start (AUDIO_BUFFER_SAMPLES), and the chord changes are played at their
+// frame inside the block, as core1 does
+//
+// render times are for the RP2040, not for the host: the CPU time of each block on the host is scaled to Cortex-M0+
+// cycles with a calibration loop, whose cost on the Cortex-M0+ is known (CALIBRATION_CYCLES per iteration), and
+// checked against the cycles the board has at TARGET_CLOCK_KHZ; the output queue of the board is modelled as well:
+// a buffer is given back to render every block duration, and it is played AUDIO_BUFFER_COUNT - 1 blocks later, so
+// the fill level and the underruns given to the audio telemetry are those the board would have with these render times
+//
+// the scale is an estimate (the host and the Cortex-M0+ do not have the same cost for each instruction): render
+// cycles measured on the board by the bench (TETRACHORDER_BENCH) are the reference, and CALIBRATION_CYCLES is to be
+// adjusted if the estimate of this test drifts away from them
+//
+// tetrachorder_chord_stress_test: exit status 1 if a block misses its deadline, or if the output queue runs out
+// of rendered buffers
+
+#define STRESS_CHANGE_MS    20          // time between two chord changes
+#define STRESS_SECONDS      10          // rendered audio for each program
+#define STRESS_CHORD_NOTES  8           // notes of each chord: two chords are 16 notes, so notes are stolen as well
+
+#define TARGET_CLOCK_KHZ    200000      // system clock of the board (set_sys_clock_khz() in tetrachorder.c)
+
+// calibration loop: one voice sample read from a 256-sample waveform in SRAM, scaled and mixed, as in render_channel()
+// on Cortex-M0+: adds, lsrs, lsls, ldrsh (2), muls, asrs, adds, subs, bne (2), ie. 11 cycles per iteration
+#define CALIBRATION_CYCLES  11
+#define CALIBRATION_VOICES  16
+#define CALIBRATION_RUNS    16
+
+// CPU time of the thread (ns): the host may preempt the test, this is not counted
+static uint64_t cpu_time_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec;
+}
+
+static int16_t calibration_table[256];
+static volatile int32_t calibration_sink;
+
+// host ns for one iteration of the calibration loop (the fastest of several runs, as the host has other work)
+static double calibrate(void) {
+    static int32_t mix[SAMPLES_PER_BUFFER];
+    double best = 0;
+
+    for (int i = 0; i < 256; i++) calibration_table[i] = (int16_t) ((i * 2749) & 0xffff);
+    for (int run = 0; run < CALIBRATION_RUNS; run++) {
+        uint64_t start = cpu_time_ns();
+
+        for (int b = 0; b < SAMPLE_RATE / SAMPLES_PER_BUFFER; b++) {
+            for (int v = 0; v < CALIBRATION_VOICES; v++) {
+                uint32_t phase = (uint32_t) b, increment = 0x00400000 + (uint32_t) v * 0x00123456;
+                int32_t gain = 0x7fff - v;
+
+                for (int s = 0; s < SAMPLES_PER_BUFFER; s++) {
+                    phase += increment;
+                    mix[s] += (calibration_table[phase >> 24] * gain) >> 16;
+                }
+            }
+            calibration_sink = mix[b];
+        }
+
+        double ns = (double) (cpu_time_ns() - start) /
+            ((double) (SAMPLE_RATE / SAMPLES_PER_BUFFER) * CALIBRATION_VOICES * SAMPLES_PER_BUFFER);
+        if ((run == 0) || (ns < best)) best = ns;
+    }
+    return best;
+}
+
+static const int programs[] = { 0, 6 };     // long release (1000 ms), and long attack (120 ms)
+
+// chord changes go around this cycle: chord A, chord B, chord A again (notes of A in release), A pressed again while it
+// is held (notes of A in attack, decay or sustain, as repeated USB MIDI note on)
+static void chord_change(uint32_t change, const noteset_t *a, const noteset_t *b, uint32_t *retriggers) {
+    ChordEvent event;
+
+    chord_event_init(&event);
+    switch (change % 4) {
+        case 0:
+        case 2:
+            event.off = *b;
+            event.on = *a;
+            break;
+        case 1:
+            event.off = *a;
+            event.on = *b;
+            break;
+        default:
+            event.on = *a;
+            break;
+    }
+    for (int note = noteset_next(&event.on, 0); note >= 0; note = noteset_next(&event.on, note + 1)) {
+        if (get_note_channel((uint8_t) note) != NO_CHANNEL) (*retriggers)++;
+    }
+    apply_chord_event(&event);
+}
+
+// output queue of the board, in Cortex-M0+ cycles: block k can be rendered from the time its buffer is given back (one
+// buffer every block duration), once block k - 1 is rendered, and it is played AUDIO_BUFFER_COUNT - 1 blocks after
+// its buffer was given back; when a block is late, the output plays silence and the following blocks are played later
+typedef struct {
+    uint64_t duration;                  // playing time of a block
+    uint64_t rendered;                  // time the last block was rendered
+    uint64_t late;                      // delay of the output, after underruns
+    uint32_t block;                     // blocks given to the output
+} OutputQueue;
+
+static void queue_block(OutputQueue *queue, uint64_t render_cycles, uint32_t samples) {
+    uint64_t released = queue->block * queue->duration + queue->late;
+    uint64_t start = MAX(released, queue->rendered);
+    uint64_t played = released + (AUDIO_BUFFER_COUNT - 1) * queue->duration;
+    uint32_t fill = 0;
+
+    queue->rendered = start + render_cycles;
+    if (queue->rendered > played) {
+        // the output plays silence until the next block duration after the block is rendered
+        telemetry_underrun();
+        queue->late += (queue->rendered - played + queue->duration - 1) / queue->duration * queue->duration;
+    } else {
+        // blocks rendered before this one, and not played yet
+        fill = (uint32_t) MIN((played - queue->rendered) / queue->duration, (uint64_t) queue->block);
+    }
+    queue->block++;
+    telemetry_block((uint32_t) (render_cycles / (TARGET_CLOCK_KHZ / 1000)), samples, fill);
+}
+
+static bool stress(int program, double cycles_per_ns) {
+    noteset_t a, b;
+    uint32_t samples = AUDIO_BUFFER_SAMPLES, change_frames = STRESS_CHANGE_MS * SAMPLE_RATE / 1000;
+    uint32_t frames = STRESS_SECONDS * SAMPLE_RATE, next_change = 0, change = 0, retriggers = 0;
+    uint32_t counters[TELEMETRY_COUNTERS];
+    uint64_t worst_cycles = 0;
+    OutputQueue queue = { (uint64_t) samples * TARGET_CLOCK_KHZ * 1000 / SAMPLE_RATE, 0, 0, 0 };
+    static int16_t block[SAMPLES_PER_BUFFER];
+
+    noteset_clear(&a);
+    noteset_clear(&b);
+    for (int i = 0; i < STRESS_CHORD_NOTES; i++) {
+        noteset_add(&a, 36 + 5 * i);
+        noteset_add(&b, 38 + 5 * i);
+    }
+
+    reset_playback_all();
+    instrument_task(program);
+    telemetry_reset();
+
+    for (uint32_t frame = 0; frame < frames; frame += samples) {
+        uint64_t start = cpu_time_ns();
+        uint32_t done = 0;
+
+        // the block is split at the frames of the chord changes
+        while (next_change < frame + samples) {
+            uint32_t at = next_change - frame;
+            if (at > done) render_audio_block(block + done, at - done);
+            done = at;
+            chord_change(change++, &a, &b, &retriggers);
+            next_change += change_frames;
+        }
+        render_audio_block(block + done, samples - done);
+
+        uint64_t cycles = (uint64_t) ((double) (cpu_time_ns() - start) * cycles_per_ns);
+        if (cycles > worst_cycles) worst_cycles = cycles;
+        queue_block(&queue, cycles, samples);
+        load_wavetables();                  // waveforms are copied to SRAM between blocks, as core1 does
+    }
+
+    telemetry_read(counters);
+    bool ok = (counters[TELEMETRY_DEADLINE_MISSES] == 0) && (counters[TELEMETRY_UNDERRUNS] == 0) && (retriggers > 0);
+    printf("program %-8d %s: %lu chord changes, %lu retriggers, %lu blocks, render worst %lu us (%lu cycles, budget %lu), "
+        "mean %lu us, deadline %lu us, %lu deadline misses, %lu underruns, lowest fill %lu\n", program, ok ? "ok" : "FAILS",
+        (unsigned long) change, (unsigned long) retriggers, (unsigned long) counters[TELEMETRY_BLOCKS],
+        (unsigned long) counters[TELEMETRY_RENDER_WORST], (unsigned long) worst_cycles, (unsigned long) queue.duration,
+        (unsigned long) counters[TELEMETRY_RENDER_MEAN], (unsigned long) counters[TELEMETRY_BLOCK_DURATION],
+        (unsigned long) counters[TELEMETRY_DEADLINE_MISSES], (unsigned long) counters[TELEMETRY_UNDERRUNS],
+        (unsigned long) counters[TELEMETRY_FILL_LOWEST]);
+    return ok;
+}
+
+int main() {
+    int failed = 0;
+
+    // Cortex-M0+ cycles for one ns of the host
+    double cycles_per_ns = CALIBRATION_CYCLES / calibrate();
+    printf("calibration: %.3f ns per voice sample on the host, %d cycles on the board: %.2f cycles per ns\n",
+        CALIBRATION_CYCLES / cycles_per_ns, CALIBRATION_CYCLES, cycles_per_ns);
+
+    set_audio_rate_and_volume(SAMPLE_RATE, VOLUME);
+    for (int p = 0; p < (int) count_of(programs); p++) {
+        if (!stress(programs[p], cycles_per_ns)) failed++;
+    }
+    return failed ? 1 : 0;
+}
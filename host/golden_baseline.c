@@ -0,0 +1,254 @@
+#include <math.h>
+#include "pico/stdlib.h"
+
+#include "globals.h"
+#include "audio.h"
+#include "synth.h"
+#include "golden_baseline.h"
+
+
+// Baseline engine: the render path of the firmware before the engine rewrites (get_audio_frame() of synth.c, and the
+// note handling of core1_main() in play.c, as of the first commit of the repository), kept for the golden references
+//
+// the code is the baseline code, with its own channels and with the instrument tables of play.c; the only changes are
+// the ones needed to run it from the golden harness: chord changes are played at their frame, in the order of
+// apply_chord_event() (program, notes off, notes on), instead of one MIDI message per audio buffer, and the phase
+// accumulator is the one of the current engine when GOLDEN_BASELINE_PITCH is 0 (see golden_baseline.h)
+
+extern const uint32_t phase_increments[];
+extern const uint32_t instruments[64][6];
+extern const int16_t waveforms[64][8][256];
+
+// note frequencies of the baseline (Hz): rounded to the Hz, they give its phase steps
+static const float frequencies[] = {
+    8.176, 8.662, 9.177, 9.723, 10.301, 10.913, 11.562, 12.250,
+    12.978, 13.750, 14.568, 15.434, 16.352, 17.324, 18.354, 19.445,
+    20.602, 21.827, 23.125, 24.500, 25.957, 27.500, 29.135, 30.868,
+    32.703, 34.648, 36.708, 38.891, 41.203, 43.654, 46.249, 48.999,
+    51.913, 55.000, 58.270, 61.735, 65.406, 69.296, 73.416, 77.782,
+    82.407, 87.307, 92.499, 97.999, 103.826, 110.000, 116.541, 123.471,
+    130.813, 138.591, 146.832, 155.563, 164.814, 174.614, 184.997, 195.998,
+    207.652, 220.000, 233.082, 246.942, 261.626, 277.183, 293.665, 311.127,
+    329.628, 349.228, 369.994, 391.995, 415.305, 440.000, 466.164, 493.883,
+    523.251, 554.365, 587.330, 622.254, 659.255, 698.456, 739.989, 783.991,
+    830.609, 880.000, 932.328, 987.767, 1046.502, 1108.731, 1174.659, 1244.508,
+    1318.510, 1396.913, 1479.978, 1567.982, 1661.219, 1760.000, 1864.655, 1975.533,
+    2093.005, 2217.461, 2349.318, 2489.016, 2637.020, 2793.826, 2959.955, 3135.963,
+    3322.438, 3520.000, 3729.310, 3951.066, 4186.009, 4434.922, 4698.636, 4978.032,
+    5274.041, 5587.652, 5919.911, 6271.927, 6644.875, 7040.000, 7458.620, 7902.133,
+    8372.018, 8869.844, 9397.273, 9956.063, 10548.080, 11175.300, 11839.820, 12543.850
+};
+
+// channel of the baseline engine (AudioChannel as it was, without the filter fields, which were never used)
+typedef struct {
+    uint8_t waveforms;
+    uint16_t frequency;
+    uint16_t volume;
+    uint8_t midi_note;
+    uint16_t attack_ms;
+    uint16_t decay_ms;
+    uint16_t sustain;
+    uint16_t sustain_ms;
+    uint16_t release_ms;
+    uint32_t waveform_offset;
+    uint32_t adsr_frame;
+    uint32_t adsr_end_frame;
+    uint32_t adsr;
+    int32_t adsr_step;
+    ADSRPhase adsr_phase;
+} BaselineChannel;
+
+static BaselineChannel channels_0[CHANNEL_COUNT];
+
+
+static void trigger_attack_0(BaselineChannel* channel) {
+    channel->waveform_offset = 0;
+    channel->adsr_frame = 0;
+    channel->adsr = 0;
+    channel->adsr_phase = ADSR_ATTACK;
+    channel->adsr_end_frame = (channel->attack_ms * SAMPLE_RATE) / 1000;
+    channel->adsr_step = (int32_t)(0xffffff) / (int32_t)(channel->adsr_end_frame);
+}
+
+static void retrigger_attack_0(BaselineChannel* channel) {
+    uint32_t frame = 0;
+    uint32_t adsr = 0;
+
+    channel->adsr_phase = ADSR_ATTACK;
+    channel->adsr_end_frame = (channel->attack_ms * SAMPLE_RATE) / 1000;
+    channel->adsr_step = (int32_t)(0xffffff) / (int32_t)(channel->adsr_end_frame);
+    while (adsr < channel->adsr) {
+        frame++;
+        adsr += channel->adsr_step;
+    }
+    channel->adsr_frame = frame;
+    channel->adsr = adsr;
+}
+
+static void trigger_decay_0(BaselineChannel* channel) {
+    channel->adsr_frame = 0;
+    channel->adsr_phase = ADSR_DECAY;
+    channel->adsr_end_frame = (channel->decay_ms * SAMPLE_RATE) / 1000;
+    channel->adsr_step = ((int32_t)(channel->sustain << 8) - (int32_t)(channel->adsr)) / (int32_t)(channel->adsr_end_frame);
+}
+
+static void trigger_sustain_0(BaselineChannel* channel) {
+    channel->adsr_frame = 0;
+    channel->adsr_phase = ADSR_SUSTAIN;
+    channel->adsr_end_frame = (channel->sustain_ms * SAMPLE_RATE) / 1000;
+    channel->adsr_step = 0;
+}
+
+static void trigger_release_0(BaselineChannel* channel) {
+    channel->adsr_frame = 0;
+    channel->adsr_phase = ADSR_RELEASE;
+    channel->adsr_end_frame = (channel->release_ms * SAMPLE_RATE) / 1000;
+    channel->adsr_step = ((int32_t)(0) - (int32_t)(channel->adsr)) / (int32_t)(channel->adsr_end_frame);
+}
+
+static void off_0(BaselineChannel* channel) {
+    channel->adsr_frame = 0;
+    channel->adsr = 0;
+    channel->adsr_phase = ADSR_OFF;
+    channel->adsr_step = 0;
+}
+
+static int16_t get_audio_frame_0(void) {
+    int32_t sample = 0;
+    int32_t channel_sample;
+    int index = 0;
+
+    for (int c = 0; c < CHANNEL_COUNT; c++) {
+        BaselineChannel* channel = &channels_0[c];
+        channel_sample = 0;
+
+#if GOLDEN_BASELINE_PITCH
+        channel->waveform_offset += ((channel->frequency * SAMPLES_PER_BUFFER) << 8) / SAMPLE_RATE;
+#else
+        channel->waveform_offset += phase_increments[channel->midi_note];
+#endif
+
+        if (channel->adsr_phase == ADSR_OFF) continue;
+
+        if (channel->adsr_frame >= channel->adsr_end_frame) {
+            switch (channel->adsr_phase) {
+                case ADSR_ATTACK:
+                    trigger_decay_0(channel);
+                    break;
+                case ADSR_DECAY:
+                    trigger_sustain_0(channel);
+                    break;
+                case ADSR_SUSTAIN:
+                    trigger_release_0(channel);
+                    break;
+                case ADSR_RELEASE:
+                    off_0(channel);
+                    break;
+                default:
+                    break;
+            }
+        }
+
+        channel->adsr += channel->adsr_step;
+        channel->adsr_frame++;
+#if GOLDEN_BASELINE_PITCH
+        channel->waveform_offset &= 0xffff;
+#endif
+
+        if (channel->frequency == 0) channel_sample = 0;
+        else {
+            if ((channel->midi_note <= 35)) index = 0;
+            if ((channel->midi_note >= 36) && (channel->midi_note <= 47)) index = 1;
+            if ((channel->midi_note >= 48) && (channel->midi_note <= 59)) index = 2;
+            if ((channel->midi_note >= 60) && (channel->midi_note <= 71)) index = 3;
+            if ((channel->midi_note >= 72) && (channel->midi_note <= 83)) index = 4;
+            if ((channel->midi_note >= 84) && (channel->midi_note <= 95)) index = 5;
+            if ((channel->midi_note >= 96) && (channel->midi_note <= 107)) index = 6;
+            if ((channel->midi_note >= 108)) index = 7;
+
+#if GOLDEN_BASELINE_PITCH
+            channel_sample = (int32_t)(waveforms [channel->waveforms][index][(channel->waveform_offset) >> 8]);
+#else
+            channel_sample = (int32_t)(waveforms [channel->waveforms][index][(channel->waveform_offset) >> 24]);
+#endif
+        }
+
+        channel_sample = ((int64_t)(channel_sample) * (int32_t)(channel->adsr >> 8)) >> 16;
+        channel_sample = ((int64_t)(channel_sample) * (int32_t)(channel->volume)) >> 16;
+        sample += channel_sample;
+    }
+    sample = ((int64_t)(sample) * (int32_t)(VOLUME)) >> 20;
+    sample = (sample <= -0x8000) ? -0x8000 : ((sample > 0x7fff) ? 0x7fff : sample);
+    return sample;
+}
+
+static void update_playback_0(int chan, uint8_t note, bool retrigger) {
+    channels_0[chan].midi_note = note;
+    channels_0[chan].frequency = (uint16_t) roundf(frequencies [note]);
+    if (retrigger) retrigger_attack_0(&channels_0[chan]);
+    else trigger_attack_0(&channels_0[chan]);
+}
+
+static void stop_playback_0(int chan) {
+    if ((channels_0[chan].adsr_phase != ADSR_OFF) && (channels_0[chan].adsr_phase != ADSR_RELEASE)) {
+        trigger_release_0(&channels_0[chan]);
+    }
+}
+
+static void instrument_task_0(int instr) {
+    for (int chan = 0; chan < CHANNEL_COUNT; chan++) {
+        channels_0[chan].waveforms   = instr;
+        channels_0[chan].attack_ms   = instruments [instr][0];
+        channels_0[chan].decay_ms    = instruments [instr][1];
+        channels_0[chan].sustain     = instruments [instr][2];
+        channels_0[chan].sustain_ms  = instruments [instr][3];
+        channels_0[chan].release_ms  = instruments [instr][4];
+        channels_0[chan].volume      = instruments [instr][5];
+    }
+}
+
+// note off and note on messages of core1_main()
+static void note_off_0(uint8_t note) {
+    for (int i = 0; i < CHANNEL_COUNT; i++) {
+        if (channels_0[i].midi_note == note) stop_playback_0(i);
+    }
+}
+
+static void note_on_0(uint8_t note) {
+    // same note played already (still in ADSR): attack again
+    for (int i = 0; i < CHANNEL_COUNT; i++) {
+        if ((channels_0[i].adsr_phase != ADSR_OFF) && (channels_0[i].midi_note == note)) {
+            update_playback_0(i, note, true);
+            return;
+        }
+    }
+    // else the first free channel; the note is dropped if all the channels play
+    for (int i = 0; i < CHANNEL_COUNT; i++) {
+        if (channels_0[i].adsr_phase == ADSR_OFF) {
+            update_playback_0(i, note, false);
+            return;
+        }
+    }
+}
+
+
+// all channels off (reset_playback_all() of the baseline), then the program of a script
+void baseline_reset(int program) {
+    for (int i = 0; i < CHANNEL_COUNT; i++) {
+        channels_0[i] = (BaselineChannel) { 0 };
+        off_0(&channels_0[i]);
+    }
+    instrument_task_0(program);
+}
+
+// a chord change, in the order of apply_chord_event()
+void baseline_apply_chord_event(const ChordEvent *event) {
+    if (event->program != NO_PROGRAM) instrument_task_0(event->program);
+    for (int i = noteset_next(&event->off, 0); i >= 0; i = noteset_next(&event->off, i + 1)) note_off_0((uint8_t) i);
+    for (int i = noteset_next(&event->on, 0); i >= 0; i = noteset_next(&event->on, i + 1)) note_on_0((uint8_t) i);
+}
+
+// n samples, one get_audio_frame() call each, as update_buffer() did
+void baseline_render(int16_t *out, uint32_t n) {
+    for (uint32_t i = 0; i < n; i++) out[i] = get_audio_frame_0();
+}
@@ -0,0 +1,22 @@
+#ifndef GOLDEN_BASELINE_H
+#define GOLDEN_BASELINE_H
+
+#include <stdint.h>
+#include "pico/stdlib.h"
+#include "event_ring.h"
+
+
+// Baseline engine of the golden harness (host/golden_baseline.c): renders chord changes as the firmware did before the
+// engine rewrites, so that references can be recorded from it (tetrachorder_golden -b)
+//
+// GOLDEN_BASELINE_PITCH 1: phase steps of the baseline, from the note frequency rounded to the Hz, on a 16-bit phase
+// GOLDEN_BASELINE_PITCH 0: phase steps of the current engine (Q8.24), so that the waveforms stay in phase
+#ifndef GOLDEN_BASELINE_PITCH
+#define GOLDEN_BASELINE_PITCH 0
+#endif
+
+void baseline_reset(int program);
+void baseline_apply_chord_event(const ChordEvent *event);
+void baseline_render(int16_t *out, uint32_t n);
+
+#endif // GOLDEN_BASELINE_H
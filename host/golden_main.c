@@ -0,0 +1,284 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "pico/stdlib.h"
+
+#include "globals.h"
+#include "audio.h"
+#include "synth.h"
+#include "play.h"
+#include "event_ring.h"
+#include "golden_baseline.h"
+
+
+// Golden-audio harness: renders scripted chord changes through the synth engine of core1, and compares the audio with
+// reference PCM recorded by a former build, so that changes to the render path which change the sound are found
+//
+// - each script is rendered block by block, with its chord changes played at their frame by apply_chord_event(), as
+//   core1 does; the audio is compared sample by sample, bit-exact or within an error bound
+// - the state of the channels (note, ADSR phase and volume, phase accumulator) is recorded after each block along with
+//   the audio: on the first divergent frame, the first channel whose state differs is reported as the divergent voice
+//   (a change of the mix only shows as a divergent frame with no divergent voice)
+//
+// two sets of references are compared by ctest:
+// - host/golden (test "golden"): audio and channel states of the engine as of the voice allocator and ADSR clamp fixes,
+//   compared bit-exact; they are to be recorded again (-r host/golden) only when a change of the sound is intended, in
+//   the same commit as the change
+// - host/golden/baseline (test "golden_baseline"): audio of the baseline engine (host/golden_baseline.c, the firmware
+//   before the engine rewrites), recorded with -b -r; the engine of this build is compared with it within the bound of
+//   each script, which allows the intended differences:
+//   - phase steps: the baseline rounded note frequencies to the Hz on a 16-bit phase, so its pitch drifts from the
+//     Q8.24 phase steps and no sample bound could hold; the baseline engine is run with the phase steps of the current
+//     engine instead (GOLDEN_BASELINE_PITCH 0), the rest of its render path is as it was
+//   - envelopes: the baseline advanced the ADSR volume before each sample, one step ahead of the current engine; ADSR
+//     phase transitions are now taken at the start of a 16-sample period (control rate), so a release may start up to
+//     15 samples later, and the volume ramps by period
+//   - mix: per-voice scaling with one 32-bit gain rounds differently from the two 64-bit multiplies, by up to 1 LSB
+//   - voice stealing: the baseline dropped the notes played when the 16 channels were busy, so voice_stealing is not
+//     compared with the baseline
+//   the chord changes of the scripts are played at their frame by both engines (the baseline firmware took one MIDI
+//   message per audio buffer: this timing is not compared)
+//
+// tetrachorder_golden -r dir            record the references of all the scripts in dir (NAME.pcm and NAME.voices)
+// tetrachorder_golden [-e error] dir    compare with the references in dir: error is the largest difference allowed
+//                                       between two samples (default 0, bit-exact); exit status 1 if a script diverges
+// tetrachorder_golden -b -r dir         record the references of the baseline engine in dir (NAME.pcm only)
+// tetrachorder_golden -b [-e error] dir compare with the references of the baseline engine in dir (error: default, the
+//                                       bound of each script)
+
+#define GOLDEN_BLOCK        SAMPLES_PER_BUFFER
+#define GOLDEN_MAX_STEPS    16
+#define GOLDEN_MAX_NOTES    24
+
+// chord change of a script, at a frame: program (or NO_PROGRAM), then notes off, then notes on (lists end with 0)
+typedef struct {
+    uint32_t frame;
+    int16_t program;
+    uint8_t off[GOLDEN_MAX_NOTES + 1];
+    uint8_t on[GOLDEN_MAX_NOTES + 1];
+} GoldenStep;
+
+typedef struct {
+    const char *name;
+    int program;                            // program at start
+    uint32_t frames;                        // length of the script, release tails included
+    int baseline_error;                     // largest difference allowed with the baseline references, -1: not compared
+    GoldenStep steps[GOLDEN_MAX_STEPS];     // by frame; the list ends with a step at frame 0 (after the first step)
+} GoldenScript;
+
+// state of a channel after a block
+typedef struct {
+    uint32_t midi_note;
+    uint32_t adsr_phase;
+    uint32_t adsr;
+    uint32_t waveform_offset;
+} VoiceState;
+
+#define MS(ms) ((uint32_t) ((uint64_t) (ms) * SAMPLE_RATE / 1000))
+
+static const GoldenScript scripts[] = {
+    { "chord_changes", 0, MS(4000), 16, {
+        { 0,        NO_PROGRAM, { 0 },              { 48, 60, 64, 67, 0 } },        // C, bass C
+        { MS(500),  NO_PROGRAM, { 48, 64, 67, 0 },  { 53, 65, 69, 0 } },            // F/F: C is kept
+        { MS(1000) + 37, NO_PROGRAM, { 53, 60, 65, 69, 0 }, { 43, 59, 62, 65, 67, 0 } },    // G7, off a block boundary
+        { MS(1500), NO_PROGRAM, { 43, 59, 62, 65, 67, 0 }, { 0 } },
+    } },
+    { "retriggers", 1, MS(3000), 8, {
+        { 0,        NO_PROGRAM, { 0 },              { 60, 0 } },
+        { MS(10),   NO_PROGRAM, { 60, 0 },          { 60, 0 } },                    // retrigger in attack
+        { MS(400),  NO_PROGRAM, { 60, 0 },          { 0 } },
+        { MS(600),  NO_PROGRAM, { 0 },              { 60, 0 } },                    // retrigger in release
+        { MS(1000), NO_PROGRAM, { 60, 0 },          { 60, 64, 0 } },                // off and on at the same frame
+        { MS(1500), NO_PROGRAM, { 60, 64, 0 },      { 0 } },
+    } },
+    { "program_changes", 0, MS(3000), 8, {
+        { 0,        NO_PROGRAM, { 0 },              { 45, 57, 60, 64, 0 } },
+        { MS(400),  6,          { 0 },              { 0 } },                        // while notes are played
+        { MS(800),  11,         { 45, 0 },          { 40, 0 } },                    // with a chord change
+        { MS(1200), 3,          { 40, 57, 60, 64, 0 }, { 0 } },                     // with the release of all the notes
+    } },
+    { "release_tails", 2, MS(4000), 48, {
+        { 0,        NO_PROGRAM, { 0 },              { 36, 48, 55, 60, 64, 67, 71, 74, 0 } },
+        { MS(300),  NO_PROGRAM, { 36, 48, 55, 60, 64, 67, 71, 74, 0 }, { 0 } },
+    } },
+    { "voice_stealing", 4, MS(3000), -1, {
+        { 0,        NO_PROGRAM, { 0 },              { 36, 40, 43, 47, 48, 52, 55, 59, 60, 64, 67, 71, 0 } },
+        { MS(200),  NO_PROGRAM, { 0 },              { 72, 74, 76, 77, 79, 81, 83, 84, 0 } },    // 20 notes: 4 stolen
+        { MS(700),  NO_PROGRAM, { 36, 40, 72, 74, 0 }, { 38, 41, 0 } },
+        { MS(1200), NO_PROGRAM, { 38, 41, 43, 47, 48, 52, 55, 59, 60, 64, 67, 71, 76, 77, 79, 81, 83, 84, 0 }, { 0 } },
+    } },
+};
+
+
+// a chord change, played by the engine of this build, or by the baseline engine
+static void apply_step(const GoldenStep *step, bool baseline) {
+    ChordEvent event;
+
+    chord_event_init(&event);
+    event.program = step->program;
+    for (int i = 0; step->off[i]; i++) noteset_add(&event.off, step->off[i]);
+    for (int i = 0; step->on[i]; i++) noteset_add(&event.on, step->on[i]);
+    if (baseline) baseline_apply_chord_event(&event);
+    else apply_chord_event(&event);
+}
+
+static void save_voices(VoiceState *voices) {
+    for (int c = 0; c < CHANNEL_COUNT; c++) {
+        voices[c].midi_note = channels[c].midi_note;
+        voices[c].adsr_phase = channels[c].adsr_phase;
+        voices[c].adsr = channels[c].adsr;
+        voices[c].waveform_offset = channels[c].waveform_offset;
+    }
+}
+
+// render a script: frames samples in pcm, and the state of the channels after each block in voices
+// (the baseline engine has no voice state: voices is left as is)
+static void render_script(const GoldenScript *script, int16_t *pcm, VoiceState *voices, bool baseline) {
+    int step = 0;
+    uint32_t frame = 0;
+
+    reset_playback_all();
+    instrument_task(script->program);
+    if (baseline) baseline_reset(script->program);
+
+    for (uint32_t block = 0; block * GOLDEN_BLOCK < script->frames; block++) {
+        uint32_t end = MIN((block + 1) * GOLDEN_BLOCK, script->frames);
+
+        // the block is split at the frames of the chord changes, as core1 does
+        while (frame < end) {
+            while ((step < GOLDEN_MAX_STEPS) && ((step == 0) || script->steps[step].frame) &&
+                (script->steps[step].frame <= frame)) apply_step(&script->steps[step++], baseline);
+            uint32_t next = end;
+            if ((step < GOLDEN_MAX_STEPS) && script->steps[step].frame) next = MIN(next, script->steps[step].frame);
+            if (baseline) baseline_render(pcm + frame, next - frame);
+            else render_audio_block(pcm + frame, next - frame);
+            frame = next;
+        }
+        save_voices(voices + block * CHANNEL_COUNT);
+        load_wavetables();                  // waveforms are copied to SRAM between blocks, as core1 does
+    }
+}
+
+static bool write_file(const char *path, const void *data, size_t size) {
+    FILE *f = fopen(path, "wb");
+    bool ok = f && (fwrite(data, 1, size, f) == size);
+
+    if (f) ok = !fclose(f) && ok;
+    if (!ok) fprintf(stderr, "%s: cannot write\n", path);
+    return ok;
+}
+
+static bool read_file(const char *path, void *data, size_t size) {
+    FILE *f = fopen(path, "rb");
+    bool ok = f && (fread(data, 1, size, f) == size) && (fgetc(f) == EOF);
+
+    if (f) fclose(f);
+    if (!ok) fprintf(stderr, "%s: missing, or not recorded for this script\n", path);
+    return ok;
+}
+
+// compare a script with its reference; returns true if all the samples are within the error bound
+static bool compare_script(const GoldenScript *script, const int16_t *pcm, const VoiceState *voices,
+    const int16_t *ref_pcm, const VoiceState *ref_voices, int error) {
+    int max_diff = 0;
+    uint32_t first = script->frames, count = 0;
+
+    for (uint32_t i = 0; i < script->frames; i++) {
+        int diff = abs(pcm[i] - ref_pcm[i]);
+        if (diff > max_diff) max_diff = diff;
+        if (diff > error) {
+            if (first == script->frames) first = i;
+            count++;
+        }
+    }
+    if (!count) {
+        printf("%-16s ok (largest difference %d)\n", script->name, max_diff);
+        return true;
+    }
+
+    uint32_t block = first / GOLDEN_BLOCK;
+    printf("%-16s DIVERGES at frame %lu (%.3f s, block %lu): %d instead of %d, %lu frames beyond %d, largest difference %d\n",
+        script->name, (unsigned long) first, (double) first / SAMPLE_RATE, (unsigned long) block, pcm[first], ref_pcm[first],
+        (unsigned long) count, error, max_diff);
+    if (!ref_voices) return false;
+
+    // first channel whose state differs, from the start of the script to the block of the divergent frame
+    for (uint32_t b = 0; b <= block; b++) {
+        for (int c = 0; c < CHANNEL_COUNT; c++) {
+            const VoiceState *v = &voices[b * CHANNEL_COUNT + c], *r = &ref_voices[b * CHANNEL_COUNT + c];
+            if (!memcmp(v, r, sizeof(VoiceState))) continue;
+            printf("%-16s voice %d diverges after block %lu: note %lu / %lu, ADSR phase %lu / %lu, ADSR %lu / %lu, "
+                "phase 0x%08lx / 0x%08lx (this build / reference)\n", "", c, (unsigned long) b,
+                (unsigned long) v->midi_note, (unsigned long) r->midi_note, (unsigned long) v->adsr_phase,
+                (unsigned long) r->adsr_phase, (unsigned long) v->adsr, (unsigned long) r->adsr,
+                (unsigned long) v->waveform_offset, (unsigned long) r->waveform_offset);
+            return false;
+        }
+    }
+    printf("%-16s no voice state diverges: the mix differs\n", "");
+    return false;
+}
+
+static void usage() {
+    fprintf(stderr,
+        "usage: tetrachorder_golden [-b] -r dir          record the references in dir\n"
+        "       tetrachorder_golden [-b] [-e error] dir  compare with the references in dir (error: default 0, bit-exact)\n"
+        "       -b: references of the baseline engine (error: default, the bound of each script in scripts[])\n");
+}
+
+int main(int argc, char **argv) {
+    bool record = false, baseline = false, bound = false;
+    int error = 0, opt;
+
+    while ((opt = getopt(argc, argv, "rbe:h")) != -1) {
+        switch (opt) {
+            case 'r': record = true; break;
+            case 'b': baseline = true; break;
+            case 'e': error = atoi(optarg); bound = true; break;
+            default: usage(); return 2;
+        }
+    }
+    if ((optind != argc - 1) || (error < 0)) {
+        usage();
+        return 2;
+    }
+    const char *dir = argv[optind];
+
+    set_audio_rate_and_volume(SAMPLE_RATE, VOLUME);
+
+    int failed = 0;
+    for (int s = 0; s < (int) count_of(scripts); s++) {
+        const GoldenScript *script = &scripts[s];
+        if (baseline && (script->baseline_error < 0)) {
+            printf("%-16s not compared with the baseline\n", script->name);
+            continue;
+        }
+
+        uint32_t blocks = (script->frames + GOLDEN_BLOCK - 1) / GOLDEN_BLOCK;
+        size_t pcm_size = script->frames * sizeof(int16_t), voices_size = blocks * CHANNEL_COUNT * sizeof(VoiceState);
+        int16_t *pcm = malloc(pcm_size), *ref_pcm = malloc(pcm_size);
+        VoiceState *voices = malloc(voices_size), *ref_voices = malloc(voices_size);
+        char pcm_path[4096], voices_path[4096];
+
+        snprintf(pcm_path, sizeof(pcm_path), "%s/%s.pcm", dir, script->name);
+        snprintf(voices_path, sizeof(voices_path), "%s/%s.voices", dir, script->name);
+        // the baseline engine only renders the references: the engine of this build is compared with them
+        render_script(script, pcm, voices, baseline && record);
+
+        if (record) {
+            if (write_file(pcm_path, pcm, pcm_size) && (baseline || write_file(voices_path, voices, voices_size)))
+                printf("%-16s recorded (%lu frames)\n", script->name, (unsigned long) script->frames);
+            else failed++;
+        }
+        else if (!read_file(pcm_path, ref_pcm, pcm_size) || (!baseline && !read_file(voices_path, ref_voices, voices_size)) ||
+            !compare_script(script, pcm, voices, ref_pcm, baseline ? NULL : ref_voices,
+                (baseline && !bound) ? script->baseline_error : error)) failed++;
+
+        free(pcm);
+        free(ref_pcm);
+        free(voices);
+        free(ref_voices);
+    }
+    return failed ? 1 : 0;
+}
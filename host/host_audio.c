@@ -0,0 +1,49 @@
+#include "pico/stdlib.h"
+#include <stdint.h>
+
+#include "audio.h"
+
+
+// Host (Linux) stand-in for audio.c: there is no I2S output, the host tools call render_audio_block() themselves
+// update_buffer() renders one buffer of the current geometry and drops it, so core1's loop runs at full speed
+
+
+static uint32_t buffer_count = AUDIO_BUFFER_COUNT;
+static uint32_t buffer_samples = AUDIO_BUFFER_SAMPLES;
+static int16_t buffer[SAMPLES_PER_BUFFER];
+
+struct audio_buffer_pool *init_audio() {
+    return NULL;
+}
+
+void set_audio_buffers(uint32_t count, uint32_t samples) {
+    buffer_count = MAX(2, MIN(count, AUDIO_MAX_BUFFERS));
+    buffer_samples = MAX(AUDIO_MIN_SAMPLES, MIN(samples, SAMPLES_PER_BUFFER));
+}
+
+// no render core on the host: the geometry changes at once
+void request_audio_buffers(uint32_t count, uint32_t samples) {
+    set_audio_buffers(count, samples);
+}
+
+void get_audio_buffers(uint32_t *count, uint32_t *samples) {
+    *count = buffer_count;
+    *samples = buffer_samples;
+}
+
+void update_buffer(struct audio_buffer_pool *ap, block_callback cb) {
+    (void) ap;
+    cb(buffer, buffer_samples);
+}
+
+void update_buffer_per_sample(struct audio_buffer_pool *ap, buffer_callback cb) {
+    (void) ap;
+    for (uint32_t i = 0; i < buffer_samples; i++) buffer[i] = cb();
+}
+
+#if AUDIO_IRQ_RENDER
+void start_audio_irq(struct audio_buffer_pool *ap, block_callback cb) {
+    (void) ap;
+    (void) cb;
+}
+#endif
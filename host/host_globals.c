@@ -0,0 +1,3 @@
+// Host (Linux) build: the globals of the firmware, with their initial values (defined in tetrachorder.c on the board)
+
+#include "tetrachorder.h"
@@ -0,0 +1,51 @@
+#include <time.h>
+#include "pico/stdlib.h"
+
+
+// Host (Linux) timing for the Pico SDK calls used by the synth and chord engine
+
+
+static uint64_t start_us = 0;
+
+static uint64_t monotonic_us(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + (uint64_t) ts.tv_nsec / 1000;
+}
+
+// us since the first call, as time since boot on the board
+uint64_t time_us_64(void) {
+    uint64_t now = monotonic_us();
+
+    if (start_us == 0) start_us = now;
+    return now - start_us;
+}
+
+uint32_t time_us_32(void) {
+    return (uint32_t) time_us_64();
+}
+
+absolute_time_t get_absolute_time(void) {
+    return time_us_64();
+}
+
+uint64_t to_us_since_boot(absolute_time_t t) {
+    return t;
+}
+
+void sleep_us(uint64_t us) {
+    struct timespec ts = { (time_t) (us / 1000000), (long) (us % 1000000) * 1000 };
+
+    nanosleep(&ts, NULL);
+}
+
+void sleep_ms(uint32_t ms) {
+    sleep_us((uint64_t) ms * 1000);
+}
+
+void busy_wait_us(uint64_t us) {
+    uint64_t end = time_us_64() + us;
+
+    while (time_us_64() < end);
+}
@@ -0,0 +1,17 @@
+#ifndef HOST_HARDWARE_SYNC_H
+#define HOST_HARDWARE_SYNC_H
+
+// Host (Linux) stand-in for the Pico SDK hardware/sync.h: memory barriers are the compiler's, so the event ring keeps
+// its ordering if the host tools ever run core0 and core1 code on two threads
+
+#include <stdint.h>
+
+static inline void __mem_fence_acquire(void) { __atomic_thread_fence(__ATOMIC_ACQUIRE); }
+static inline void __mem_fence_release(void) { __atomic_thread_fence(__ATOMIC_RELEASE); }
+static inline void __dmb(void) { __atomic_thread_fence(__ATOMIC_SEQ_CST); }
+
+// there are no interrupts on the host
+static inline uint32_t save_and_disable_interrupts(void) { return 0; }
+static inline void restore_interrupts(uint32_t status) { (void) status; }
+
+#endif // HOST_HARDWARE_SYNC_H
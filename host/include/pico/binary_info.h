@@ -0,0 +1,8 @@
+#ifndef HOST_PICO_BINARY_INFO_H
+#define HOST_PICO_BINARY_INFO_H
+
+// Host (Linux) stand-in for the Pico SDK pico/binary_info.h: no binary info on the host
+
+#define bi_decl(...)
+
+#endif // HOST_PICO_BINARY_INFO_H
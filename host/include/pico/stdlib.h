@@ -0,0 +1,50 @@
+#ifndef HOST_PICO_STDLIB_H
+#define HOST_PICO_STDLIB_H
+
+// Host (Linux) stand-in for the Pico SDK pico/stdlib.h: only what the synth and chord engine use
+// (types, macros, timing); see host/CMakeLists.txt
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef unsigned int uint;
+
+#ifndef MIN
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#endif
+#ifndef MAX
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+#endif
+#define count_of(a) (sizeof(a) / sizeof((a)[0]))
+#define __unused __attribute__((unused))
+
+// code and data placement: everything is in RAM on the host
+#define __not_in_flash_func(f) f
+#define __time_critical_func(f) f
+#define __scratch_x(n)
+#define __scratch_y(n)
+
+// timing: monotonic clock, in us since the first call (host/host_hal.c)
+typedef uint64_t absolute_time_t;
+
+uint64_t time_us_64(void);
+uint32_t time_us_32(void);
+absolute_time_t get_absolute_time(void);
+uint64_t to_us_since_boot(absolute_time_t t);
+void sleep_us(uint64_t us);
+void sleep_ms(uint32_t ms);
+void busy_wait_us(uint64_t us);
+
+// repeating timers are not run on the host; the type is needed by keypad.h
+typedef struct repeating_timer {
+    int64_t delay_us;
+    void *user_data;
+} repeating_timer_t;
+
+// core sleep and events: there is a single thread on the host
+static inline void __wfe(void) {}
+static inline void __sev(void) {}
+static inline void __wfi(void) {}
+
+#endif // HOST_PICO_STDLIB_H
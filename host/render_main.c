@@ -0,0 +1,361 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "pico/stdlib.h"
+
+#include "globals.h"
+#include "audio.h"
+#include "synth.h"
+#include "play.h"
+#include "event_ring.h"
+
+
+// Host renderer: plays Standard MIDI Files (format 0 or 1) through the synth engine of core1, and writes 16-bit mono
+// WAV files at SAMPLE_RATE, faster than real time
+//
+// - MIDI events at the same time are gathered into records by chord_event_add_midi(), and played by apply_chord_event(),
+//   as core1 plays the USB MIDI input: notes, program changes, pitch bend, and volume / all sound off / all notes off
+// - the synth has one instrument for all its channels and no velocity: program changes apply to all the notes (programs
+//   beyond the instruments of the synth are ignored), and velocity only tells note on (> 0) from note off (0); a
+//   recording of the tetrachorder USB MIDI output plays as on the board
+// - after the last event, the release tails are rendered until all channels are off (at most -t seconds)
+//
+// tetrachorder_render [-c channel] [-p program] [-t tail] [-o out.wav] file.mid
+// tetrachorder_render [-c channel] [-p program] [-t tail] [-d dir] file.mid...     (batch: dir/file.wav for each file)
+
+#define RENDER_MAX_EVENTS   65536           // MIDI events kept from a file
+#define RENDER_TAIL_S       10              // longest release tail rendered after the last event (s)
+
+typedef struct {
+    uint32_t tick;                          // absolute time in ticks
+    uint32_t order;                         // order in the file, so that events at the same tick keep it when sorted
+    uint8_t status;                         // MIDI status, or 0xFF for a tempo change
+    uint8_t data1;
+    uint8_t data2;
+    uint32_t tempo;                         // us per quarter note, for tempo changes
+} MidiEvent;
+
+static MidiEvent events[RENDER_MAX_EVENTS];
+static int event_count;
+
+static int midi_channel = 0;                // 1 to 16, or 0 to play all channels
+static int start_program = 0;               // program before the first program change
+static int tail_s = RENDER_TAIL_S;
+
+
+/**********************/
+/* Standard MIDI File */
+/**********************/
+
+static uint32_t read_be(const uint8_t *p, int n) {
+    uint32_t v = 0;
+
+    while (n--) v = (v << 8) | *p++;
+    return v;
+}
+
+// variable-length quantity; returns false if it runs past the end
+static bool read_vlq(const uint8_t **p, const uint8_t *end, uint32_t *value) {
+    uint32_t v = 0;
+
+    for (int i = 0; i < 4; i++) {
+        if (*p >= end) return false;
+        uint8_t b = *(*p)++;
+        v = (v << 7) | (b & 0x7F);
+        if (!(b & 0x80)) {
+            *value = v;
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool add_event(uint32_t tick, uint8_t status, uint8_t data1, uint8_t data2, uint32_t tempo) {
+    if (event_count >= RENDER_MAX_EVENTS) return false;
+    events[event_count] = (MidiEvent) { tick, (uint32_t) event_count, status, data1, data2, tempo };
+    event_count++;
+    return true;
+}
+
+// keep the channel messages the synth plays, and the tempo changes
+static bool parse_track(const uint8_t *p, const uint8_t *end) {
+    uint32_t tick = 0;
+    uint8_t running = 0;
+
+    while (p < end) {
+        uint32_t delta, length;
+        if (!read_vlq(&p, end, &delta)) return false;
+        tick += delta;
+        if (p >= end) return false;
+
+        uint8_t status = *p;
+        if (status == 0xFF) {                                       // meta event
+            if (end - p < 2) return false;
+            uint8_t type = p[1];
+            p += 2;
+            if (!read_vlq(&p, end, &length) || (uint32_t) (end - p) < length) return false;
+            if ((type == 0x51) && (length == 3) && !add_event(tick, 0xFF, 0, 0, read_be(p, 3))) return false;
+            if (type == 0x2F) return true;                          // end of track
+            p += length;
+            continue;
+        }
+        if ((status == 0xF0) || (status == 0xF7)) {                 // sysex
+            p++;
+            if (!read_vlq(&p, end, &length) || (uint32_t) (end - p) < length) return false;
+            p += length;
+            continue;
+        }
+
+        if (status & 0x80) p++;                                     // else running status
+        else status = running;
+        if (!(status & 0x80)) return false;
+        running = status;
+
+        int size = ((status & 0xE0) == 0xC0) ? 1 : 2;               // program change and channel pressure: 1 byte
+        if (end - p < size) return false;
+        uint8_t data1 = p[0], data2 = (size == 2) ? p[1] : 0;
+        p += size;
+
+        if (midi_channel && ((status & 0x0F) != midi_channel - 1)) continue;
+        switch (status & 0xF0) {
+            case 0x80:
+            case 0x90:
+            case 0xB0:
+            case 0xC0:
+            case 0xE0:
+                if (!add_event(tick, status, data1, data2, 0)) return false;
+                break;
+            default:
+                break;
+        }
+    }
+    return true;
+}
+
+static int compare_events(const void *a, const void *b) {
+    const MidiEvent *ea = a, *eb = b;
+
+    if (ea->tick != eb->tick) return (ea->tick < eb->tick) ? -1 : 1;
+    return (ea->order < eb->order) ? -1 : 1;
+}
+
+// read a file into events[], sorted by time; returns ticks per quarter note, or 0 on error
+static uint32_t read_midi_file(const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        fprintf(stderr, "%s: cannot open\n", path);
+        return 0;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t *data = malloc(size > 0 ? size : 1);
+    bool ok = data && (size >= 14) && (fread(data, 1, size, f) == (size_t) size);
+    fclose(f);
+
+    uint32_t division = 0;
+    if (ok && !memcmp(data, "MThd", 4) && (read_be(data + 4, 4) >= 6)) {
+        uint32_t tracks = read_be(data + 10, 2);
+        division = read_be(data + 12, 2);
+        if (division & 0x8000) {
+            fprintf(stderr, "%s: SMPTE time division is not supported\n", path);
+            division = 0;
+        }
+
+        const uint8_t *p = data + 8 + read_be(data + 4, 4), *end = data + size;
+        event_count = 0;
+        for (uint32_t t = 0; division && (t < tracks); t++) {
+            if ((end - p < 8) || memcmp(p, "MTrk", 4) || (read_be(p + 4, 4) > (uint32_t) (end - p - 8))) {
+                fprintf(stderr, "%s: bad track %lu\n", path, (unsigned long) t);
+                division = 0;
+                break;
+            }
+            uint32_t length = read_be(p + 4, 4);
+            if (!parse_track(p + 8, p + 8 + length)) {
+                fprintf(stderr, "%s: bad or too many events in track %lu\n", path, (unsigned long) t);
+                division = 0;
+                break;
+            }
+            p += 8 + length;
+        }
+    }
+    else fprintf(stderr, "%s: not a Standard MIDI File\n", path);
+
+    free(data);
+    if (division) qsort(events, event_count, sizeof(MidiEvent), compare_events);
+    return division;
+}
+
+
+/**********/
+/* Render */
+/**********/
+
+static void write_le(FILE *f, uint32_t value, int n) {
+    for (int i = 0; i < n; i++) fputc((value >> (8 * i)) & 0xFF, f);
+}
+
+static void write_wav_header(FILE *f, uint32_t frames) {
+    fwrite("RIFF", 1, 4, f);
+    write_le(f, 36 + frames * 2, 4);
+    fwrite("WAVEfmt ", 1, 8, f);
+    write_le(f, 16, 4);                     // PCM format chunk
+    write_le(f, 1, 2);                      // PCM
+    write_le(f, 1, 2);                      // mono
+    write_le(f, SAMPLE_RATE, 4);
+    write_le(f, SAMPLE_RATE * 2, 4);        // bytes per second
+    write_le(f, 2, 2);                      // bytes per frame
+    write_le(f, 16, 2);                     // bits per sample
+    fwrite("data", 1, 4, f);
+    write_le(f, frames * 2, 4);
+}
+
+// render n frames, block by block as core1 does
+static void render_frames(FILE *f, uint64_t n) {
+    int16_t block[SAMPLES_PER_BUFFER];
+
+    while (n) {
+        uint32_t size = (n < SAMPLES_PER_BUFFER) ? (uint32_t) n : SAMPLES_PER_BUFFER;
+        render_audio_block(block, size);
+        for (uint32_t i = 0; i < size; i++) write_le(f, (uint16_t) block[i], 2);
+        load_wavetables();                  // waveforms are copied to SRAM between blocks, as core1 does
+        n -= size;
+    }
+}
+
+// play the events of the file, and return the number of frames rendered
+static uint64_t render_events(FILE *f, uint32_t division) {
+    ChordEvent event;
+    uint64_t frame = 0;                     // frames rendered
+    uint32_t tick = 0;                      // time of the last tempo change, in ticks and in us
+    double tick_us = 0;
+    uint32_t tempo = 500000;                // us per quarter note (120 bpm)
+
+    reset_playback_all();
+    instrument_task(start_program);
+    set_audio_rate_and_volume(SAMPLE_RATE, VOLUME);
+    chord_event_init(&event);
+
+    for (int i = 0; i <= event_count; i++) {
+        MidiEvent *e = &events[i];
+        uint64_t event_frame = frame;
+
+        if (i < event_count) {
+            double us = tick_us + (double) (e->tick - tick) * tempo / division;
+            event_frame = (uint64_t) (us * SAMPLE_RATE / 1000000 + 0.5);
+            if (e->status == 0xFF) {
+                tick = e->tick;
+                tick_us = us;
+                tempo = e->tempo;
+                continue;
+            }
+        }
+
+        // the events gathered so far are played at their frame (the current one), before a later event or an event
+        // they would be played out of order with
+        if ((i == event_count) || (event_frame > frame)) {
+            if (!chord_event_is_empty(&event)) apply_chord_event(&event);
+            chord_event_init(&event);
+        }
+        if (i == event_count) break;
+        if (event_frame > frame) {
+            render_frames(f, event_frame - frame);
+            frame = event_frame;
+        }
+
+        if (!chord_event_add_midi(&event, e->status, e->data1, e->data2)) {
+            apply_chord_event(&event);
+            chord_event_init(&event);
+            chord_event_add_midi(&event, e->status, e->data1, e->data2);
+        }
+    }
+
+    // release tails
+    for (uint64_t tail = 0; active_count && (tail < (uint64_t) tail_s * SAMPLE_RATE); tail += SAMPLES_PER_BUFFER) {
+        render_frames(f, SAMPLES_PER_BUFFER);
+        frame += SAMPLES_PER_BUFFER;
+    }
+    return frame;
+}
+
+static bool render_file(const char *in, const char *out) {
+    uint32_t division = read_midi_file(in);
+    if (!division) return false;
+
+    FILE *f = fopen(out, "wb");
+    if (!f) {
+        fprintf(stderr, "%s: cannot create\n", out);
+        return false;
+    }
+
+    struct timespec start, stop;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    write_wav_header(f, 0);
+    uint64_t frames = render_events(f, division);
+    fseek(f, 0, SEEK_SET);
+    write_wav_header(f, (uint32_t) frames);      // now that the length is known
+    bool ok = !ferror(f);
+    ok = !fclose(f) && ok;
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+
+    double seconds = (double) frames / SAMPLE_RATE;
+    double elapsed = (stop.tv_sec - start.tv_sec) + (stop.tv_nsec - start.tv_nsec) / 1e9;
+    printf("%s -> %s: %d events, %.1f s of audio in %.3f s (%.0fx real time)\n", in, out, event_count, seconds, elapsed,
+        elapsed > 0 ? seconds / elapsed : 0);
+    if (!ok) fprintf(stderr, "%s: write error\n", out);
+    return ok;
+}
+
+// output file for an input file: the same name with a .wav extension, in dir if any
+static void output_path(char *out, size_t size, const char *in, const char *dir) {
+    const char *name = dir ? (strrchr(in, '/') ? strrchr(in, '/') + 1 : in) : in;
+    const char *dot = strrchr(name, '.');
+    int length = dot ? (int) (dot - name) : (int) strlen(name);
+
+    if (dir) snprintf(out, size, "%s/%.*s.wav", dir, length, name);
+    else snprintf(out, size, "%.*s.wav", length, name);
+}
+
+static void usage() {
+    fprintf(stderr,
+        "usage: tetrachorder_render [-c channel] [-p program] [-t tail] [-o out.wav] file.mid\n"
+        "       tetrachorder_render [-c channel] [-p program] [-t tail] [-d dir] file.mid...\n"
+        "  -c  play MIDI channel 1 to 16 only (default: all channels)\n"
+        "  -p  program before the first program change (default: 0)\n"
+        "  -t  longest release tail after the last event, in s (default: %d)\n"
+        "  -o  output file (one input file only; default: input file with a .wav extension)\n"
+        "  -d  output directory (default: the directory of each input file)\n", RENDER_TAIL_S);
+}
+
+int main(int argc, char **argv) {
+    const char *out = NULL, *dir = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "c:p:t:o:d:h")) != -1) {
+        switch (opt) {
+            case 'c': midi_channel = atoi(optarg); break;
+            case 'p': start_program = atoi(optarg); break;
+            case 't': tail_s = atoi(optarg); break;
+            case 'o': out = optarg; break;
+            case 'd': dir = optarg; break;
+            default: usage(); return 2;
+        }
+    }
+    if ((optind >= argc) || (out && (argc - optind > 1)) || (midi_channel < 0) || (midi_channel > 16) ||
+        (start_program < 0) || (start_program >= get_instrument_count()) || (tail_s < 0)) {
+        usage();
+        return 2;
+    }
+
+    set_audio_rate_and_volume(SAMPLE_RATE, VOLUME);
+
+    int failed = 0;
+    for (int i = optind; i < argc; i++) {
+        char path[4096];
+        if (!out) output_path(path, sizeof(path), argv[i], dir);
+        if (!render_file(argv[i], out ? out : path)) failed++;
+    }
+    return failed ? 1 : 0;
+}
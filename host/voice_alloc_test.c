@@ -0,0 +1,89 @@
+#include <stdio.h>
+#include "pico/stdlib.h"
+
+#include "globals.h"
+#include "audio.h"
+#include "synth.h"
+#include "play.h"
+#include "voice_alloc.h"
+
+
+// Voice allocator check: with all the channels busy, successive steals (each one after the fade-out of the former) take
+// a different channel each time, for STEAL_OLDEST and for STEAL_RELEASING (with no channel in release, it falls back to
+// the oldest channel); a retriggered note is not the oldest one anymore
+//
+// tetrachorder_voice_alloc_test: exit status 1 if a check fails
+
+#define FIRST_NOTE      36              // notes of the channels before the steals: FIRST_NOTE to FIRST_NOTE + CHANNEL_COUNT - 1
+#define STEAL_NOTE      72              // notes played on stolen channels: STEAL_NOTE and up
+
+static int16_t block[SAMPLES_PER_BUFFER];
+
+static void render_ms(uint32_t ms) {
+    for (uint32_t n = ms * SAMPLE_RATE / 1000; n > 0; n -= MIN(n, SAMPLES_PER_BUFFER))
+        render_audio_block(block, MIN(n, SAMPLES_PER_BUFFER));
+}
+
+// all the channels play a note, in sustain
+static void fill_channels(void) {
+    reset_playback_all();
+    instrument_task(0);
+    for (int i = 0; i < CHANNEL_COUNT; i++) {
+        play_note(FIRST_NOTE + i);
+        render_ms(1);                   // notes start one after the other
+    }
+    render_ms(100);
+}
+
+// a note on a stolen channel, which then plays its note (fade-out over): returns the channel
+static int steal(uint8_t note) {
+    play_note(note);
+    int chan = get_note_channel(note);
+    render_ms(2 * STEAL_FADE_MS);
+    return chan;
+}
+
+static bool check_steals(const char *name, StealPolicy policy) {
+    uint32_t stolen = 0;
+
+    set_steal_policy(policy);
+    fill_channels();
+    for (int i = 0; i < CHANNEL_COUNT; i++) {
+        int chan = steal(STEAL_NOTE + i);
+        if ((chan == NO_CHANNEL) || (stolen & (1u << chan))) {
+            printf("%-16s FAILS: steal %d takes channel %d, stolen already\n", name, i + 1, chan);
+            return false;
+        }
+        stolen |= 1u << chan;
+    }
+    printf("%-16s ok (%d steals, %d different channels)\n", name, CHANNEL_COUNT, CHANNEL_COUNT);
+    return true;
+}
+
+static bool check_retrigger(void) {
+    set_steal_policy(STEAL_OLDEST);
+    fill_channels();
+
+    // oldest note is retriggered: the next steal takes the second oldest note
+    int retriggered = get_note_channel(FIRST_NOTE);
+    play_note(FIRST_NOTE);
+    render_ms(10);
+    int chan = steal(STEAL_NOTE);
+    if ((chan == retriggered) || (chan != get_note_channel(STEAL_NOTE)) || (get_note_channel(FIRST_NOTE + 1) != NO_CHANNEL)) {
+        printf("%-16s FAILS: steal after a retrigger takes channel %d (retriggered channel %d)\n", "retrigger", chan, retriggered);
+        return false;
+    }
+    printf("%-16s ok\n", "retrigger");
+    return true;
+}
+
+int main() {
+    int failed = 0;
+
+    set_audio_rate_and_volume(SAMPLE_RATE, VOLUME);
+    if (!check_steals("steal_oldest", STEAL_OLDEST)) failed++;
+    if (!check_steals("steal_releasing", STEAL_RELEASING)) failed++;
+    if (!check_retrigger()) failed++;
+    set_steal_policy(STEAL_RELEASING);
+    return failed ? 1 : 0;
+}
@@ -53,114 +53,97 @@ bool build_full_chord (uint8_t root, void *pointer) {
 }
 
 
+// keyboard layout: key of the keypad array for each key of the keyboard
+// chromatic keyboard, indexed by note C=1 C#=2 D=3 D#=4 E=5 F=6 F#=7 G=8 G#=9 A=10 A#=11 B=12 (0 is unused)
+static const uint8_t note_keys [13] = {0, 24, 25, 20, 21, 16, 12, 17, 8, 13, 4, 9, 0};
+
+// modulation keyboard, in the order the modulations are applied to the chord
+enum {ADD9, MAJ3, B5, MAJ7, ADD11, NO3, NO5, NO7, NB_MODIFIERS};
+static const uint8_t modifier_keys [NB_MODIFIERS] = {3, 7, 11, 2, 27, 23, 19, 15};
+
+// instrument switches sw2 to sw7, from bit 5 to bit 0 of the instrument (sw0 and sw1 are not wired: 64 instruments)
+// we invert boolean to cope with HW soldering issue
+#define NB_SWITCHES 6
+static const uint8_t switch_keys [NB_SWITCHES] = {22, 26, 14, 18, 6, 10};
+
+// chord bitmap for each combination of modulation keys (bit n of the index is modifier n)
+// the bitmap is relative to the root note, so it does not depend on which chromatic key is pressed
+static uint32_t chord_bitmaps [1 << NB_MODIFIERS];
+
+
+// build the table of chord bitmaps at boot, by applying the modulations to a full chord the same way as they are applied
+// when keys are pressed
+void build_chord_table () {
+
+	chord_t chord;
+
+	for (int mods = 0; mods < (1 << NB_MODIFIERS); mods++) {
+		reset_rootnote (&chord);
+		build_full_chord (1, &chord);
+		if (mods & (1 << ADD9)) set_9 (&chord);
+		if (mods & (1 << MAJ3)) {
+			reset_3 (&chord);
+			set_3 (&chord);
+		}
+		if (mods & (1 << B5)) {
+			reset_5 (&chord);
+			set_b5 (&chord);
+		}
+		if (mods & (1 << MAJ7)) {
+			reset_7 (&chord);
+			set_7 (&chord);
+		}
+		if (mods & (1 << ADD11)) set_11 (&chord);
+		if (mods & (1 << NO3)) reset_3 (&chord);
+		if (mods & (1 << NO5)) reset_5 (&chord);
+		if (mods & (1 << NO7)) reset_7 (&chord);
+		chord_bitmaps [mods] = chord.bitmap;
+	}
+}
+
+
 // parse keyboard and based on which key is pressed, build chord
-// kbd is a pointer to an array of bools; this array indicates whether the key is pressed or not
-// this allows to have an instant photograph of the keyboard at regular times, and use this to build chord
-// as inputs, it uses pointer to chord (which will be populated based on which key is pressed) and pointer to KeypadMatrix (gotten from keypad_read() function)
+// kbd is the KeypadMatrix updated by keypad_read(): pressed_mask is an instant photograph of the keyboard, and
+// changed_mask tells which keys changed since the former photograph; if none did, chord and instrument are unchanged
+// as inputs, it uses pointer to chord (which will be populated based on which key is pressed) and pointer to KeypadMatrix
 // it returns the pointer to chord array fully populated, as well as instrument number
 uint8_t parse_keyboard (void *pointer, KeypadMatrix *kbd) {
 
 	chord_t *chord = (chord_t *)pointer;
-	bool pressed [13];											// if the key has been pressed
-	uint64_t when_pressed [13];									// when the key has been pressed
+	static uint8_t parsed_instrument = 0;	// instrument of the last photograph (the global instrument is the one of the main loop)
+	static bool parsed = false;						// the keyboard has been parsed once at least
+	uint32_t pressed = kbd->pressed_mask;
 	int i, index;
 
-	// define which key corresponds to which byte in the keypad array; yes this is tedious, but this is better for readibility and quick changes
-	bool add11 = kbd->pressed [27];
-	bool no3   = kbd->pressed [23];
-	bool no5   = kbd->pressed [19];
-	bool no7   = kbd->pressed [15];
-	bool add9  = kbd->pressed [3];
-	bool maj3  = kbd->pressed [7];
-	bool b5    = kbd->pressed [11];
-	bool maj7  = kbd->pressed [2];
-	// instrument on 6-bit (64 instruments) instead of 8-bit (256 instruments)
-	bool sw0   = false;
-	bool sw1   = false;
-//	bool sw0   = kbd->pressed [(5 * KBD_COL) + 0];
-//	bool sw1   = kbd->pressed [(5 * KBD_COL) + 1];
-	// we invert boolean to cope with HW soldering issue
-	bool sw2   = !kbd->pressed [22];
-	bool sw3   = !kbd->pressed [26];
-	bool sw4   = !kbd->pressed [14];
-	bool sw5   = !kbd->pressed [18];
-	bool sw6   = !kbd->pressed [6];
-	bool sw7   = !kbd->pressed [10];
-
-	// chromatic keyboard
-	when_pressed [0]  = 0;												// when the key has been pressed
-	when_pressed [1]  = kbd->press_times [24];
-	when_pressed [2]  = kbd->press_times [25];
-	when_pressed [3]  = kbd->press_times [20];
-	when_pressed [4]  = kbd->press_times [21];
-	when_pressed [5]  = kbd->press_times [16];
-	when_pressed [6]  = kbd->press_times [12];
-	when_pressed [7]  = kbd->press_times [17];
-	when_pressed [8]  = kbd->press_times [8];
-	when_pressed [9]  = kbd->press_times [13];
-	when_pressed [10] = kbd->press_times [4];
-	when_pressed [11] = kbd->press_times [9];
-	when_pressed [12] = kbd->press_times [0];
-
-	pressed [0]  = false;										// if the key has been pressed
-	pressed [1]  = kbd->pressed [24];
-	pressed [2]  = kbd->pressed [25];
-	pressed [3]  = kbd->pressed [20];
-	pressed [4]  = kbd->pressed [21];
-	pressed [5]  = kbd->pressed [16];
-	pressed [6]  = kbd->pressed [12];
-	pressed [7]  = kbd->pressed [17];
-	pressed [8]  = kbd->pressed [8];
-	pressed [9]  = kbd->pressed [13];
-	pressed [10] = kbd->pressed [4];
-	pressed [11] = kbd->pressed [9];
-	pressed [12] = kbd->pressed [0];
-
-
-	// analyse the keypad, key by key
-	reset_rootnote (chord);			// start with empty chord and bass
+	if (parsed && (kbd->changed_mask == 0)) return parsed_instrument;
+	parsed = true;
 
 	// analyse instrument, and return it as a byte
-	uint8_t instrument = 0;
-	instrument = sw0 ? ((instrument | 1)<< 1) : (instrument << 1);
-	instrument = sw1 ? ((instrument | 1)<< 1) : (instrument << 1);
-	instrument = sw2 ? ((instrument | 1)<< 1) : (instrument << 1);
-	instrument = sw3 ? ((instrument | 1)<< 1) : (instrument << 1);
-	instrument = sw4 ? ((instrument | 1)<< 1) : (instrument << 1);
-	instrument = sw5 ? ((instrument | 1)<< 1) : (instrument << 1);
-	instrument = sw6 ? ((instrument | 1)<< 1) : (instrument << 1);
-	instrument = sw7 ? (instrument | 1) : instrument;
+	parsed_instrument = 0;
+	for (i = 0; i < NB_SWITCHES; i++) {
+		parsed_instrument = (parsed_instrument << 1) | ((pressed & (1u << switch_keys [i])) ? 0 : 1);
+	}
 
 	// analyse chromatic keyboard (we don't check for errors, we assume the code is correct)
 	// get the index of the key that has been pressed last
 	index = 0;
-	for (i=1; i<13; i++) {
-		if ((pressed [i]) && (when_pressed [i] >= when_pressed [index])) index = i;
+	for (i = 1; i < 13; i++) {
+		if ((pressed & (1u << note_keys [i])) && ((index == 0) || (kbd->press_times [note_keys [i]] >= kbd->press_times [note_keys [index]]))) index = i;
 	}
+
 	// index contains the chord whose key has been pressed last
+	reset_rootnote (chord);			// start with empty chord and bass
 	if (index != 0) {
-		build_full_chord (index, chord);
-
 		// analyse modulation keyboard
-		if (add9) set_9 (chord);
-		if (maj3) {
-			reset_3 (chord);
-			set_3 (chord);
-		}
-		if (b5) {
-			reset_5 (chord);
-			set_b5 (chord);
+		int mods = 0;
+		for (i = 0; i < NB_MODIFIERS; i++) {
+			if (pressed & (1u << modifier_keys [i])) mods |= 1 << i;
 		}
-		if (maj7) {
-			reset_7 (chord);
-			set_7 (chord);
-		}
-		if (add11) set_11 (chord);
-		if (no3) reset_3 (chord);
-		if (no5) reset_5 (chord);
-		if (no7) reset_7 (chord);
+		chord->rootnote = index;
+		chord->bitmap = chord_bitmaps [mods];
+		chord->bass = index;		// here we set the bass all the time; if bass if off, then we will clear the bass from the main
 	}
-	
-	return instrument;
+
+	return parsed_instrument;
 }
 
@@ -6,6 +6,7 @@
 
 
 bool build_full_chord (uint8_t , void *);
+void build_chord_table ();
 uint8_t parse_keyboard (void *, KeypadMatrix *);
 
 #endif
@@ -8,6 +8,21 @@
  */
 
 #include "keypad.h"
+#include "hardware/sync.h"
+#include "hardware/pio.h"
+#include "hardware/dma.h"
+#include "hardware/irq.h"
+#include "keypad_scan.pio.h"
+
+/**
+ * @brief Keypad scanned by PIO, for the PIO interrupt handler
+ */
+static KeypadMatrix* pio_keypad;
+
+/**
+ * @brief PIO scanner program, patched with the number of columns
+ */
+static uint16_t pio_instructions[count_of(keypad_scan_program_instructions)];
 
 /**
  * @brief No-op function for callback
@@ -41,6 +56,7 @@ void keypad_set_keys(KeypadMatrix* _kp, const uint8_t *cols, const uint8_t *rows
         _kp->_cols[i] = cols[i];
         gpio_init(cols[i]);
         gpio_set_dir(cols[i], GPIO_IN);
+        gpio_pull_down(cols[i]);
     }
     for (uint8_t i = 0; i < _kp->rows_num; i++) {
         _kp->_rows[i] = rows[i];
@@ -71,6 +87,9 @@ void keypad_init(KeypadMatrix* _kp, const uint8_t *cols, const uint8_t *rows, ui
     _kp->on_release = noop;
 
     _kp->hold_threshold = HOLD_THRESHOLD_DEFAULT;
+
+    // Scan in the background
+    keypad_start_scan(_kp);
 }
 
 /**
@@ -104,40 +123,186 @@ void keypad_on_release(KeypadMatrix* _kp, void (*callback)(uint8_t key)){
 }
 
 /**
- * @brief Read the current state of the keypad matrix
+ * @brief Scan timer callback: sample the row driven at the previous period, then drive the next row
+ *
+ * The row has settled for a whole period when it is sampled. When all the rows have been sampled, the scan is
+ * debounced: a new key bitmap is accepted once it has been read KEYPAD_DEBOUNCE_SCANS times in a row.
+ *
+ * @param rt Repeating timer, its user data being the KeypadMatrix structure
+ * @return true to keep the timer running
+ */
+static bool keypad_scan_tick(repeating_timer_t *rt){
+    KeypadMatrix* _kp = (KeypadMatrix*) rt->user_data;
+    uint8_t row = _kp->scan_row;
+
+    for (uint8_t col = 0; col < _kp->cols_num; col++) {
+        if (gpio_get(_kp->_cols[col])) _kp->scan_raw |= 1ull << ((_kp->cols_num * row) + col);
+    }
+    gpio_put(_kp->_rows[row], 0);
+
+    if (++row == _kp->rows_num) {
+        row = 0;
+        if (_kp->scan_raw != _kp->scan_previous) {
+            _kp->scan_previous = _kp->scan_raw;
+            _kp->scan_stable = 0;
+        }
+        if ((_kp->scan_stable < KEYPAD_DEBOUNCE_SCANS) && (++_kp->scan_stable == KEYPAD_DEBOUNCE_SCANS)) {
+            _kp->debounced = _kp->scan_raw;
+        }
+        _kp->scan_raw = 0;
+    }
+
+    gpio_put(_kp->_rows[row], 1);
+    _kp->scan_row = row;
+    return true;
+}
+
+/**
+ * @brief PIO interrupt handler: the scanner has pushed a new key bitmap, which DMA copies to pio_keys
+ */
+static void keypad_pio_irq_handler(void){
+    pio_interrupt_clear(KEYPAD_PIO, 0);
+    pio_keypad->scan_changed = true;
+}
+
+/**
+ * @brief Start scanning the keypad matrix with a PIO state machine, which writes the key bitmap to RAM by DMA
+ *
+ * Rows must be on consecutive GPIOs, the first row on the highest one, and columns on consecutive GPIOs, the first
+ * column on the lowest one; the bitmap has at most 32 keys.
+ *
+ * @param _kp Pointer to the KeypadMatrix structure
+ * @return false if the keypad does not fit the PIO scanner or no PIO/DMA resource is free
+ */
+bool keypad_start_pio_scan(KeypadMatrix* _kp){
+    PIO pio = KEYPAD_PIO;
+
+    if ((_kp->size > 32) || (pio_keypad != NULL)) return false;
+    for (uint8_t i = 1; i < _kp->rows_num; i++) {
+        if (_kp->_rows[i] != _kp->_rows[0] - i) return false;
+    }
+    for (uint8_t i = 1; i < _kp->cols_num; i++) {
+        if (_kp->_cols[i] != _kp->_cols[0] + i) return false;
+    }
+
+    // Sample as many columns as the keypad has
+    struct pio_program program = keypad_scan_program;
+    for (uint i = 0; i < count_of(pio_instructions); i++) pio_instructions[i] = keypad_scan_program_instructions[i];
+    pio_instructions[keypad_scan_offset_row + 1] = pio_encode_in(pio_pins, _kp->cols_num);
+    program.instructions = pio_instructions;
+
+    if (!pio_can_add_program(pio, &program)) return false;
+    int sm = pio_claim_unused_sm(pio, false);
+    if (sm < 0) return false;
+    int dma = dma_claim_unused_channel(false);
+    if (dma < 0) {
+        pio_sm_unclaim(pio, sm);
+        return false;
+    }
+
+    _kp->scan_pio = true;
+    _kp->scan_changed = false;
+    _kp->scan_accepted_us = time_us_32() - KEYPAD_LOCKOUT_US;
+    _kp->pio_keys = 0;
+    _kp->debounced = 0;
+    pio_keypad = _kp;
+
+    // DMA copies each bitmap pushed by the scanner to pio_keys
+    dma_channel_config c = dma_channel_get_default_config(dma);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+    channel_config_set_read_increment(&c, false);
+    channel_config_set_write_increment(&c, false);
+    channel_config_set_dreq(&c, pio_get_dreq(pio, sm, false));
+    dma_channel_configure(dma, &c, &_kp->pio_keys, &pio->rxf[sm], 0xFFFFFFFF, true);
+
+    // The scanner raises an interrupt when the bitmap changes
+    pio_set_irq0_source_enabled(pio, pis_interrupt0, true);
+    uint irq = PIO0_IRQ_0 + 2 * pio_get_index(pio);     // IRQ 0 of the PIO block in use
+    irq_set_exclusive_handler(irq, keypad_pio_irq_handler);
+    irq_set_enabled(irq, true);
+
+    uint offset = pio_add_program(pio, &program);
+    keypad_scan_program_init(pio, sm, offset, _kp->_rows[_kp->rows_num - 1], _kp->rows_num, _kp->_cols[0], KEYPAD_PIO_FREQ);
+    return true;
+}
+
+/**
+ * @brief Start scanning the keypad matrix in the background, by PIO if possible, else by a timer
+ *
+ * The timer runs in the alarm interrupt of the calling core.
+ *
+ * @param _kp Pointer to the KeypadMatrix structure
+ */
+void keypad_start_scan(KeypadMatrix* _kp){
+    _kp->scan_pio = false;
+    if (keypad_start_pio_scan(_kp)) return;
+
+    _kp->scan_row = 0;
+    _kp->scan_stable = 0;
+    _kp->scan_raw = 0;
+    _kp->scan_previous = 0;
+    _kp->debounced = 0;
+    gpio_put(_kp->_rows[0], 1);
+    add_repeating_timer_us(-KEYPAD_SCAN_PERIOD_US, keypad_scan_tick, _kp, &_kp->scan_timer);
+}
+
+/**
+ * @brief Get the debounced key bitmap from the background scan
+ *
+ * @param _kp Pointer to the KeypadMatrix structure
+ * @return Key bitmap, bit k being set if key k is pressed
+ */
+uint64_t keypad_get_state(KeypadMatrix* _kp){
+    if (_kp->scan_pio) {
+        // A change is accepted at once (key detection within one PIO scan), then ignored while the contacts bounce
+        uint32_t now = time_us_32();
+        if (_kp->scan_changed && (now - _kp->scan_accepted_us >= KEYPAD_LOCKOUT_US)) {
+            _kp->scan_changed = false;
+            _kp->debounced = _kp->pio_keys;
+            _kp->scan_accepted_us = now;
+        }
+        return _kp->debounced;
+    }
+
+    // A 64-bit read takes two accesses: the scan interrupt must not update the bitmap in between
+    uint32_t status = save_and_disable_interrupts();
+    uint64_t state = _kp->debounced;
+    restore_interrupts(status);
+    return state;
+}
+
+/**
+ * @brief Process the latest state of the keypad matrix and call the callbacks; does not wait
  *
  * @param _kp Pointer to the KeypadMatrix structure
  * @return Pointer to the array of key press states
  */
 bool * keypad_read(KeypadMatrix* _kp){
     uint64_t now = time_us_64();
-    for (uint8_t row = 0; row < _kp->rows_num; row++) {
-        gpio_put(_kp->_rows[row], 1);
-        busy_wait_us(10000);
-        for (int col = 0; col < _kp->cols_num; col++) {
-            uint8_t k = (_kp->cols_num * row) + col;
-            _kp->pressed[k] = gpio_get(_kp->_cols[col]);
-
-            if(_kp->pressed[k] != _kp->previous_pressed[k]){
-                if(_kp->pressed[k]) {
-                    _kp->on_press(k);
-                    _kp->press_times[k] = now;
-                } else {
-                    _kp->on_release(k);
-                    _kp->long_pressed[k] = false;
-                }
-                _kp->previous_pressed[k] = _kp->pressed[k];
+    uint64_t state = keypad_get_state(_kp);
+    _kp->changed_mask = (uint32_t) state ^ _kp->pressed_mask;
+    _kp->pressed_mask = (uint32_t) state;
+    for (uint8_t k = 0; k < _kp->size; k++) {
+        _kp->pressed[k] = (state >> k) & 1;
+
+        if(_kp->pressed[k] != _kp->previous_pressed[k]){
+            if(_kp->pressed[k]) {
+                _kp->on_press(k);
+                _kp->press_times[k] = now;
             } else {
-                if(_kp->pressed[k]){
-                    uint64_t duration = now - _kp->press_times[k];
-                    if (duration > (_kp->hold_threshold * 1000) && !_kp->long_pressed[k]){
-                        _kp->on_long_press(k);
-                        _kp->long_pressed[k] = true;
-                    }
+                _kp->on_release(k);
+                _kp->long_pressed[k] = false;
+            }
+            _kp->previous_pressed[k] = _kp->pressed[k];
+        } else {
+            if(_kp->pressed[k]){
+                uint64_t duration = now - _kp->press_times[k];
+                if (duration > (_kp->hold_threshold * 1000) && !_kp->long_pressed[k]){
+                    _kp->on_long_press(k);
+                    _kp->long_pressed[k] = true;
                 }
             }
         }
-        gpio_put(_kp->_rows[row], 0);
     }
     return _kp->pressed;
 }
@@ -28,6 +28,38 @@ extern "C" {
  */
 #define HOLD_THRESHOLD_DEFAULT  1500
 
+/**
+ * @def KEYPAD_SCAN_PERIOD_US
+ * @brief Period of the scan timer (100us): one row is driven per period, and sampled at the next period
+ *
+ * A 7-row matrix is scanned in 700us (about 1.4kHz).
+ */
+#define KEYPAD_SCAN_PERIOD_US   100
+
+/**
+ * @def KEYPAD_DEBOUNCE_SCANS
+ * @brief Number of consecutive identical scans before a new key state is accepted
+ */
+#define KEYPAD_DEBOUNCE_SCANS   3
+
+/**
+ * @def KEYPAD_PIO
+ * @brief PIO block used to scan the keypad matrix (pio0 is used by audio I2S)
+ */
+#define KEYPAD_PIO              pio1
+
+/**
+ * @def KEYPAD_PIO_FREQ
+ * @brief Clock of the PIO scanner (1MHz): a row settles for 8us, and a 4x7 matrix is scanned in about 85us
+ */
+#define KEYPAD_PIO_FREQ         1000000
+
+/**
+ * @def KEYPAD_LOCKOUT_US
+ * @brief Debounce of the PIO scanner: a change is accepted at once, then changes are ignored for 5ms
+ */
+#define KEYPAD_LOCKOUT_US       5000
+
 /**
  * @struct KeypadMatrix
  * @brief Structure representing a keypad matrix
@@ -53,6 +85,16 @@ typedef struct {
      */
     bool previous_pressed[SIDE_MAX_SIZE * SIDE_MAX_SIZE];
 
+    /**
+     * @brief Current key press state as a bitmap, bit k being key k (first 32 keys)
+     */
+    uint32_t pressed_mask;
+
+    /**
+     * @brief Keys whose state changed at the last keypad_read() (first 32 keys)
+     */
+    uint32_t changed_mask;
+
     /**
      * @brief Long press state
      */
@@ -83,6 +125,56 @@ typedef struct {
      */
     uint16_t hold_threshold;
 
+    /**
+     * @brief Timer driving the scan, one row per period
+     */
+    repeating_timer_t scan_timer;
+
+    /**
+     * @brief Row currently driven by the scan
+     */
+    uint8_t scan_row;
+
+    /**
+     * @brief Number of consecutive scans which returned scan_previous
+     */
+    uint8_t scan_stable;
+
+    /**
+     * @brief Key bitmap of the scan in progress (bit k is key k)
+     */
+    uint64_t scan_raw;
+
+    /**
+     * @brief Key bitmap of the previous complete scan
+     */
+    uint64_t scan_previous;
+
+    /**
+     * @brief Debounced key bitmap, updated by the scan timer, or from the PIO scanner, and processed by keypad_read()
+     */
+    volatile uint64_t debounced;
+
+    /**
+     * @brief true if the keypad is scanned by PIO, false if it is scanned by the timer
+     */
+    bool scan_pio;
+
+    /**
+     * @brief Key bitmap written by DMA each time the PIO scanner reports a change
+     */
+    volatile uint32_t pio_keys;
+
+    /**
+     * @brief Set by the PIO interrupt when the key bitmap changes
+     */
+    volatile bool scan_changed;
+
+    /**
+     * @brief Time when the last change from the PIO scanner was accepted (us)
+     */
+    uint32_t scan_accepted_us;
+
     /**
      * @brief Callback function for key press event
      */
@@ -129,7 +221,30 @@ void keypad_set_keys(KeypadMatrix* keypad_struct, const uint8_t *cols, const uin
 void keypad_init(KeypadMatrix* keypad_struct, const uint8_t *cols, const uint8_t *rows, uint8_t cols_num, uint8_t rows_num);
 
 /**
- * @brief Read the current state of the keypad matrix
+ * @brief Start scanning the keypad matrix in the background, by PIO if possible, else by a timer
+ *
+ * @param keypad_struct Pointer to the KeypadMatrix structure
+ */
+void keypad_start_scan(KeypadMatrix* keypad_struct);
+
+/**
+ * @brief Start scanning the keypad matrix with a PIO state machine, which writes the key bitmap to RAM by DMA
+ *
+ * @param keypad_struct Pointer to the KeypadMatrix structure
+ * @return false if the keypad does not fit the PIO scanner or no PIO/DMA resource is free
+ */
+bool keypad_start_pio_scan(KeypadMatrix* keypad_struct);
+
+/**
+ * @brief Get the debounced key bitmap from the background scan
+ *
+ * @param keypad_struct Pointer to the KeypadMatrix structure
+ * @return Key bitmap, bit k being set if key k is pressed
+ */
+uint64_t keypad_get_state(KeypadMatrix* keypad_struct);
+
+/**
+ * @brief Process the latest state of the keypad matrix and call the callbacks; does not wait
  *
  * @param keypad_struct Pointer to the KeypadMatrix structure
  * @return Pointer to the array of key press states
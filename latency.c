@@ -0,0 +1,105 @@
+#include "pico/stdlib.h"
+#include <stdint.h>
+#include <stdio.h>
+#include "hardware/sync.h"
+
+#include "audio.h"
+#include "latency.h"
+
+
+#define PROBE_TIMEOUT 64          // number of buffers rendered without sound before a measure is given up
+
+typedef enum {
+    PROBE_IDLE,                   // waiting for core0 to queue a NOTEON
+    PROBE_QUEUED,                 // NOTEON queued by core0, not processed by core1 yet
+    PROBE_WAIT_SOUND,             // NOTEON processed, waiting for a rendered buffer with a non-zero sample
+    PROBE_WAIT_PLAY               // waiting for the buffer holding the first non-zero sample to be played
+} ProbeState;
+
+static volatile ProbeState probe_state = PROBE_IDLE;
+static volatile uint64_t note_time;             // time when the NOTEON was queued (us)
+static struct audio_buffer *probe_buffer;       // buffer holding the first non-zero sample
+static uint32_t probe_offset;                   // position of the first non-zero sample in the buffer
+static uint32_t probe_wait;                     // number of buffers rendered while waiting for sound
+
+static uint32_t latency_count = 0;              // number of measures, and their statistics (us)
+static uint64_t latency_sum = 0;
+static uint32_t latency_min = 0xFFFFFFFF;
+static uint32_t latency_max = 0;
+static uint32_t latency_last = 0;
+static volatile bool new_result = false;
+
+
+// core0: a NOTEON is about to be queued to the synth
+void latency_note_queued() {
+    if (probe_state != PROBE_IDLE) return;
+    note_time = time_us_64();
+    __mem_fence_release();
+    probe_state = PROBE_QUEUED;
+}
+
+// core1: a NOTEON has been processed; silent is true if no channel was playing before it
+void latency_note_processed(bool silent) {
+    if (probe_state != PROBE_QUEUED) return;
+    probe_wait = 0;
+    probe_state = silent ? PROBE_WAIT_SOUND : PROBE_IDLE;
+}
+
+// core1: a buffer has been rendered and is queued for playing
+void latency_buffer_rendered(struct audio_buffer *buffer, const int16_t *samples, uint32_t n) {
+    if (probe_state != PROBE_WAIT_SOUND) return;
+    for (uint32_t i = 0; i < n; i++) {
+        if (samples[i] != 0) {
+            probe_buffer = buffer;
+            probe_offset = i;
+            probe_state = PROBE_WAIT_PLAY;
+            return;
+        }
+    }
+    if (++probe_wait >= PROBE_TIMEOUT) probe_state = PROBE_IDLE;     // note makes no sound (eg. instrument with volume 0)
+}
+
+// core1: a buffer comes back free from the audio output, which means its DMA transfer has just started
+void latency_buffer_played(struct audio_buffer *buffer) {
+    if ((probe_state != PROBE_WAIT_PLAY) || (buffer != probe_buffer)) return;
+
+    __mem_fence_acquire();
+    uint64_t sample_time = time_us_64() + (uint64_t) probe_offset * 1000000 / SAMPLE_RATE;
+    latency_last = (uint32_t) (sample_time - note_time);
+    latency_count++;
+    latency_sum += latency_last;
+    latency_min = MIN(latency_min, latency_last);
+    latency_max = MAX(latency_max, latency_last);
+    new_result = true;
+    probe_state = PROBE_IDLE;
+}
+
+// forget the measures: to be called when the buffer geometry changes
+void latency_reset() {
+    latency_count = 0;
+    latency_sum = 0;
+    latency_min = 0xFFFFFFFF;
+    latency_max = 0;
+    new_result = false;
+    probe_state = PROBE_IDLE;
+}
+
+// core1, outside of audio interrupt: print the statistics if there is a new measure
+void latency_report() {
+    uint32_t count, samples, last, min, max, n;
+    uint64_t sum;
+
+    if (!new_result) return;
+
+    // copy the statistics, so they are not updated by the audio interrupt while being printed
+    uint32_t status = save_and_disable_interrupts();
+    new_result = false;
+    last = latency_last; min = latency_min; max = latency_max; n = latency_count; sum = latency_sum;
+    restore_interrupts(status);
+    if (n == 0) return;             // measures were reset after the new one
+
+    get_audio_buffers(&count, &samples);
+    printf("latency: %lu us (min %lu, mean %lu, max %lu over %lu notes), %lu buffers of %lu samples\n",
+        (unsigned long) last, (unsigned long) min, (unsigned long) (sum / n), (unsigned long) max,
+        (unsigned long) n, (unsigned long) count, (unsigned long) samples);
+}
@@ -0,0 +1,27 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "pico/stdlib.h"
+
+
+// Latency probe, built when TETRACHORDER_LATENCY_PROBE is defined (cmake -DTETRACHORDER_LATENCY_PROBE=ON)
+//
+// measures the time from core0 queuing a NOTEON to the first non-zero sample of that note leaving the audio DMA:
+// - core0 timestamps the first NOTEON of a chord
+// - core1 keeps the measure only if no channel was playing, so the first non-zero sample rendered comes from that note
+// - the buffer holding that sample is given back free by the audio output when its DMA transfer starts: the sample
+//   leaves DMA at that time, plus its position in the buffer
+// results (min, mean, max) are printed on UART by core1 after each measure
+
+struct audio_buffer;
+
+void latency_note_queued(void);
+void latency_note_processed(bool silent);
+void latency_buffer_rendered(struct audio_buffer *buffer, const int16_t *samples, uint32_t n);
+void latency_buffer_played(struct audio_buffer *buffer);
+void latency_reset(void);
+void latency_report(void);
+
+#endif // LATENCY_H
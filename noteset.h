@@ -0,0 +1,63 @@
+#ifndef NOTESET_H
+#define NOTESET_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "pico/stdlib.h"
+
+
+// Set of midi notes (0 to 127), one bit per note
+//
+// - the notes common to two chords, the notes to be played and the notes to be released are AND / AND NOT of two sets:
+//   the cost does not depend on the number of notes in the chords
+// - a set is 16 bytes, and is copied as a whole in a chord change record for the synth
+// - set bits are iterated in ascending note order, only when events are sent:
+//     for (int note = noteset_next (&set, 0); note >= 0; note = noteset_next (&set, note + 1)) ...
+
+#define NOTESET_WORDS     4         // 4 x 32 bits: the Cortex-M0+ works on 32-bit words
+
+typedef struct {
+    uint32_t bits[NOTESET_WORDS];
+} noteset_t;
+
+static inline void noteset_clear(noteset_t *set) {
+    for (int i = 0; i < NOTESET_WORDS; i++) set->bits[i] = 0;
+}
+
+static inline void noteset_add(noteset_t *set, uint8_t note) {
+    set->bits[(note >> 5) & 3] |= 1u << (note & 31);
+}
+
+static inline void noteset_remove(noteset_t *set, uint8_t note) {
+    set->bits[(note >> 5) & 3] &= ~(1u << (note & 31));
+}
+
+static inline bool noteset_has(const noteset_t *set, uint8_t note) {
+    return (set->bits[(note >> 5) & 3] >> (note & 31)) & 1;
+}
+
+// res = a & b: notes in both sets
+static inline void noteset_and(noteset_t *res, const noteset_t *a, const noteset_t *b) {
+    for (int i = 0; i < NOTESET_WORDS; i++) res->bits[i] = a->bits[i] & b->bits[i];
+}
+
+// res = a & ~b: notes in a, but not in b
+static inline void noteset_andnot(noteset_t *res, const noteset_t *a, const noteset_t *b) {
+    for (int i = 0; i < NOTESET_WORDS; i++) res->bits[i] = a->bits[i] & ~b->bits[i];
+}
+
+static inline bool noteset_is_empty(const noteset_t *set) {
+    return (set->bits[0] | set->bits[1] | set->bits[2] | set->bits[3]) == 0;
+}
+
+// first note of the set from note "from" (included), or -1 if there is none
+static inline int noteset_next(const noteset_t *set, int from) {
+    for (int i = from >> 5; i < NOTESET_WORDS; i++) {
+        uint32_t word = set->bits[i];
+        if (i == (from >> 5)) word &= ~0u << (from & 31);
+        if (word) return (i << 5) + __builtin_ctz(word);
+    }
+    return -1;
+}
+
+#endif // NOTESET_H
@@ -1,21 +1,157 @@
 #include <stdlib.h>
 #include <stdio.h>
-#include <math.h>
+#include <string.h>
 #include "pico/stdlib.h"
 #include "pico/binary_info.h"
+#include "hardware/sync.h"
 
 #include "globals.h"
 #include "audio.h"
 #include "synth.h"
 #include "play.h"
+#include "voice_alloc.h"
+#include "event_ring.h"
+#include "bench.h"
+#include "latency.h"
 #include "waveforms.h"
 
+// the waveforms of the instruments in use are copied from flash to SRAM: in flash, they are read through the XIP cache,
+// which misses when voices spread over several instruments and octaves (and core0 code competes for the same cache)
+// an instrument is 8 waveforms of 256 samples (4 KB); a slot is shared by all the channels playing the same instrument
+// copies are made by core1 between audio interrupts (load_wavetables()): until then, a channel reads from flash
+#define WAVETABLE_SLOTS		4		// number of instruments which can be held in SRAM at the same time
+
+static int16_t wavetable_ram [WAVETABLE_SLOTS][8][256];	// SRAM copies of the waveforms (default striped SRAM banks)
+static uint8_t wavetable_instr [WAVETABLE_SLOTS];		// instrument + 1 held by each slot, 0 if the slot is empty
+static uint8_t wavetable_users [WAVETABLE_SLOTS];		// number of channels using each slot: a slot is overwritten only if 0
+static uint8_t channel_slot [CHANNEL_COUNT];			// slot + 1 used by each channel, 0 if the channel reads from flash
+static bool wavetables_in_ram = true;					// false: waveforms are read from flash (used for benchmark)
+
+// pitch bend (USB MIDI input) scales the phase steps of the notes: it is applied when a note starts or the bend changes,
+// not for each sample
+#define PITCH_BEND_RANGE	2		// pitch bend range, in semitones up and down
+#define BEND_UNITY			(1 << 16)
+
+static uint32_t bend_ratio = BEND_UNITY;				// ratio of the phase steps for the current pitch bend (Q16)
+
+// ratio of the phase steps (Q16) every 128 steps of the 14-bit pitch bend, from 0 to 16384: round (2^((bend - 8192) *
+// PITCH_BEND_RANGE / (8192 * 12)) * 65536); the ratio is interpolated linearly in between, within 2 of the exact Q16 value
+// (0.04 cent), so that no float function is called in the audio interrupt; entry 64 (bend 8192) is exactly BEND_UNITY
+#if PITCH_BEND_RANGE != 2
+#error "bend_ratios[] is computed for a pitch bend range of 2 semitones"
+#endif
+static const uint32_t bend_ratios [129] = {
+	58386, 58491, 58597, 58703, 58809, 58915, 59022, 59128,
+	59235, 59342, 59449, 59557, 59664, 59772, 59880, 59988,
+	60097, 60205, 60314, 60423, 60532, 60642, 60751, 60861,
+	60971, 61081, 61191, 61302, 61413, 61524, 61635, 61746,
+	61858, 61970, 62081, 62194, 62306, 62419, 62531, 62644,
+	62757, 62871, 62984, 63098, 63212, 63326, 63441, 63555,
+	63670, 63785, 63901, 64016, 64132, 64248, 64364, 64480,
+	64596, 64713, 64830, 64947, 65065, 65182, 65300, 65418,
+	65536, 65654, 65773, 65892, 66011, 66130, 66250, 66369,
+	66489, 66609, 66730, 66850, 66971, 67092, 67213, 67335,
+	67456, 67578, 67700, 67823, 67945, 68068, 68191, 68314,
+	68438, 68561, 68685, 68809, 68933, 69058, 69183, 69308,
+	69433, 69558, 69684, 69810, 69936, 70062, 70189, 70316,
+	70443, 70570, 70698, 70825, 70953, 71082, 71210, 71339,
+	71468, 71597, 71726, 71856, 71985, 72115, 72246, 72376,
+	72507, 72638, 72769, 72901, 73032, 73164, 73297, 73429,
+	73562
+};
+
+
+// get a slot holding the waveforms of an instrument
+// returns slot + 1, or 0 if no slot holds the instrument (the channel then reads from flash, until load_wavetables()
+// copies the instrument to SRAM): this is called in the audio interrupt, which does not copy waveforms
+static uint8_t acquire_wavetable (int instr) {
+	int i;
+
+	if (!wavetables_in_ram) return 0;
+
+	// instrument already in SRAM (even if no channel uses it anymore): no copy
+	for (i = 0; i < WAVETABLE_SLOTS; i++) {
+		if (wavetable_instr [i] == instr + 1) {
+			wavetable_users [i]++;
+			return i + 1;
+		}
+	}
+	return 0;
+}
+
+
+// the channel does not use its slot anymore
+static void release_wavetable (int chan) {
+
+	if (channel_slot [chan]) wavetable_users [channel_slot [chan] - 1]--;
+	channel_slot [chan] = 0;
+}
+
+
+// phase step of a note, pitch bend included
+static uint32_t note_increment (uint8_t note) {
+
+	if (bend_ratio == BEND_UNITY) return phase_increments [note];
+	return (uint32_t) (((uint64_t) phase_increments [note] * bend_ratio) >> 16);
+}
+
+
+// get the waveform of an instrument used to play a note: this is done when the note or the instrument changes, not for each sample
+static const int16_t *get_waveform (int chan, uint8_t note) {
+	int instr = channels[chan].waveforms;
+	uint8_t wave = note_waveforms [instrument_splits [instr]][note];
+
+	if (channel_slot [chan]) return wavetable_ram [channel_slot [chan] - 1][wave];
+	return waveforms [instr][wave];
+}
+
+
+// copy the waveforms of an instrument which is read from flash to a slot that no channel uses, then switch the channels
+// of this instrument to the copy (flash and SRAM waveforms are the same, so the notes being played do not change)
+// the 4 KB copy is made by core1 outside the audio interrupt, with the interrupt enabled: the slot is taken away first
+// so that the interrupt does not use it, and it is given its instrument once the copy is over
+// returns false if there is no instrument to copy, or no slot to copy it to
+bool load_wavetables () {
+	int instr = -1, slot = -1, i;
+
+	if (!wavetables_in_ram) return false;
+
+	uint32_t status = save_and_disable_interrupts ();
+	for (i = 0; (i < CHANNEL_COUNT) && (instr < 0); i++) {
+		if (channel_slot [i] == 0) instr = channels[i].waveforms;
+	}
+	for (i = 0; (i < WAVETABLE_SLOTS) && (instr >= 0) && (slot < 0); i++) {
+		if (wavetable_users [i] == 0) slot = i;
+	}
+	if (slot >= 0) wavetable_instr [slot] = 0;
+	restore_interrupts (status);
+	if (slot < 0) return false;
+
+	memcpy (wavetable_ram [slot], waveforms [instr], sizeof (wavetable_ram [slot]));
+
+	status = save_and_disable_interrupts ();
+	wavetable_instr [slot] = instr + 1;
+	for (i = 0; i < CHANNEL_COUNT; i++) {
+		if ((channel_slot [i] == 0) && (channels[i].waveforms == instr)) {
+			channel_slot [i] = slot + 1;
+			wavetable_users [slot]++;
+			channels[i].table = get_waveform (i, channels[i].midi_note);
+			channels[i].pending_table = get_waveform (i, channels[i].pending_note);
+		}
+	}
+	restore_interrupts (status);
+	return true;
+}
+
+
 // plays a note on a channel 
 void update_playback (int chan, uint8_t note, bool retrigger) {
 
 	// get notes data from the structure, and pass it to synthetizer
-	channels[chan].midi_note = note;
-	channels[chan].frequency = (uint16_t) roundf (frequencies [note]);
+	channels[chan].note_pending = false;					// in case channel was stolen, the note it was waiting for is replaced
+	assign_note (&channels[chan], note);					// set midi note of the channel, and find the channel from the note
+	channels[chan].phase_increment = note_increment (note);	// computed once here, and not for each sample
+	channels[chan].table = get_waveform (chan, note);
 	if (retrigger) retrigger_attack (&channels[chan]);		// retrigger attack while note is playing already
 	else trigger_attack (&channels[chan]);					// tigger attack as note is not playing already
 }
@@ -26,15 +162,71 @@ void stop_playback (int chan) {
 
 	// we must update the playback with release on a channel
 
+	// if channel has been stolen and waits for its note, then forget the note: the channel just finishes its fade-out
 	// if channel is in OFF state, then do nothing
 	// if channel is already in release state, then do nothing
 	// if channel is in another state, then go to release state
-	if ((channels[chan].adsr_phase != ADSR_OFF) && (channels[chan].adsr_phase != ADSR_RELEASE)) {
+	if (channels[chan].note_pending) {
+		cancel_pending_note (&channels[chan]);
+	}
+	else if ((channels[chan].adsr_phase != ADSR_OFF) && (channels[chan].adsr_phase != ADSR_RELEASE)) {
 		trigger_release (&channels[chan]);
 	}
 }
 
 
+// play a midi note: on the channel playing the same note already if any, else on a free channel, else on a stolen channel
+void play_note (uint8_t note) {
+
+	// check if the same note is being played already (still in ADSR, eg. in release mode); if so, then trigger attack again
+	int chan = get_note_channel (note);
+	if (chan != NO_CHANNEL) {
+		update_playback (chan, note, true);
+		return;
+	}
+
+	// in case the same note is not being played already, take a free channel to play note
+	chan = get_free_channel ();
+	if (chan != NO_CHANNEL) {
+		update_playback (chan, note, false);
+		return;
+	}
+
+	// all channels are busy: steal one based on the stealing policy; it fades out, then plays the note
+	chan = choose_stolen_channel ();
+	if (chan != NO_CHANNEL) steal_channel (&channels[chan], note, note_increment (note), get_waveform (chan, note));
+}
+
+
+// release the channel playing a midi note, if any
+void release_note (uint8_t note) {
+
+	// channel is found from the note; a note that is not played by any channel is ignored
+	int chan = get_note_channel (note);
+	if (chan != NO_CHANNEL) stop_playback (chan);
+}
+
+
+// release all the notes (all notes off)
+static void release_all_notes () {
+
+	for (int i = 0; i < CHANNEL_COUNT; i++) stop_playback (i);
+}
+
+
+// set the pitch bend (0 to 16383, 8192 is center): notes being played, and notes waiting for a stolen channel, are bent
+static void set_pitch_bend (int bend) {
+
+	const uint32_t *ratio = &bend_ratios [bend >> 7];
+
+	bend_ratio = ratio [0] + (((ratio [1] - ratio [0]) * (uint32_t) (bend & 0x7F)) >> 7);	// BEND_UNITY at center (8192)
+	for (int i = 0; i < CHANNEL_COUNT; i++) {
+		channels[i].phase_increment = note_increment (channels[i].midi_note);
+		if (channels[i].note_pending) channels[i].pending_increment = note_increment (channels[i].pending_note);
+	}
+}
+
+
 // shut down a channel
 void reset_playback (int chan) {
 
@@ -50,6 +242,7 @@ void reset_playback_all () {
 	for (int i = 0; i < CHANNEL_COUNT; i++) {
 		reset_playback (i);		// shut down channel and set it as inactive
 	}
+	init_voices ();				// all channels are free
 }
 
 
@@ -69,59 +262,50 @@ bool load_instrument(int instr, int chan) {
 	channels[chan].sustain_ms  = instruments [instr][3];
 	channels[chan].release_ms  = instruments [instr][4];
 	channels[chan].volume      = instruments [instr][5];
+	// waveforms are read from SRAM: the slot of the former instrument is given back first, so it can be reused
+	release_wavetable (chan);
+	channel_slot [chan] = acquire_wavetable (instr);
+	// waveform of the note being played (or to be played by a stolen channel) switches to the new instrument
+	channels[chan].table         = get_waveform (chan, channels[chan].midi_note);
+	channels[chan].pending_table = get_waveform (chan, channels[chan].pending_note);
 
 	return true;
 }
 
 
+// choose whether waveforms are read from SRAM copies (default) or straight from flash
+// instruments of all the channels are reloaded, so the change applies to the notes being played as well
+void set_wavetables_in_ram (bool in_ram) {
+
+	wavetables_in_ram = in_ram;
+	for (int i = 0; i < CHANNEL_COUNT; i++) release_wavetable (i);
+	for (int i = 0; i < WAVETABLE_SLOTS; i++) wavetable_instr [i] = 0;		// force new copies
+	for (int i = 0; i < CHANNEL_COUNT; i++) load_instrument (channels[i].waveforms, i);
+	while (load_wavetables ());			// this is not called from the audio interrupt: copies are made now
+}
+
+
+// number of instruments defined in instruments[] (the other entries are all 0)
+int get_instrument_count () {
+
+	return NB_INSTRUMENTS;
+}
+
+
 // go through the notes to be played, muted, etc and set the audio channels accordingly
 // send this to synthetizer so it is playde by i2s pico audio board
 void song_task() {
 
-	int i, j;
-	bool found;
+	int i;
 	
-	// go through the list of notes to be kept untouched, and do nothing to the channel
-	for (i=0; i < midi_notes_common_size; i++) {
-		for (j = 0; j < CHANNEL_COUNT; j++) {
-			if (channels[j].midi_note == midi_notes_common[i]);		// do nothing
-		}
-	}
+	// notes to be kept untouched (midi_notes_common) require nothing to be done on the channels
 
 	// go through the list of midi notes off, and stop corresponding channel, put the channel as inactive;
-	for (i=0; i < midi_notes_off_size; i++) {
-		for (j = 0; j < CHANNEL_COUNT; j++) {
-			if (channels[j].midi_note == midi_notes_off[i]) {
-				// stop channel, set inactive
-				stop_playback (j);
-				// channels[j].off();
-			}
-		}
-	}
+	for (i = noteset_next (&midi_notes_off, 0); i >= 0; i = noteset_next (&midi_notes_off, i + 1)) release_note ((uint8_t) i);
 
-	// go through the list of midi notes on, and start corresponding channel, by: 1- making sure the note is not played already (should not happen as in this case, the note should // be in the "untouched" list), and 2- we assign note to an inactive channel
-	for (i=0; i < midi_notes_on_size; i++) {
-		found = false;
-		// check if the same note is being played already (still in ADSR, eg. in release mode); if so, then trigger attack again
-		for (j = 0; j < CHANNEL_COUNT; j++) {
-			if ((channels[j].adsr_phase != ADSR_OFF) && (channels[j].midi_note == midi_notes_on[i])) {
-				// channel plays same note already: let's use it and attack again!
-				update_playback (j, midi_notes_on[i], true);
-				found = true;
-				break;			// assign note to a single channel, then move to next note
-			}
-		}
-		if (found) break;		// if we play the note, then leave
-
-		// in case the same note is not being played already, find an empty channel to play note
-		for (j = 0; j < CHANNEL_COUNT; j++) {
-			if (channels[j].adsr_phase == ADSR_OFF) {
-				// empty channel: let's use it and play!
-				update_playback (j, midi_notes_on[i], false);
-				break;			// assign note to a single channel, then move to next note
-			}
-		}
-	}
+	// go through the list of midi notes on, and start corresponding channel: the same channel if the note is played already,
+	// else a free channel, else a stolen channel (notes are never dropped)
+	for (i = noteset_next (&midi_notes_on, 0); i >= 0; i = noteset_next (&midi_notes_on, i + 1)) play_note ((uint8_t) i);
 }
 
 
@@ -132,67 +316,112 @@ void instrument_task(int instr) {
 }
 
 
-void core1_main() {		//The program running on core 1
+// play a chord change received from core0: program change first, then all sound / notes off, then notes off, then notes on,
+// then pitch bend and volume
+// (also used by the host renderer, so that files are played as core1 plays chord changes)
+void apply_chord_event (const ChordEvent *event) {
+	int i;
+
+	// programs from USB MIDI input may be beyond the instruments of the synth: they are ignored
+	if ((event->program != NO_PROGRAM) && (event->program < NB_INSTRUMENTS)) instrument_task (event->program);
+	if (event->controls & EVENT_ALL_SOUND_OFF) reset_playback_all ();
+	if (event->controls & EVENT_ALL_NOTES_OFF) release_all_notes ();
+	// stop channel, set inactive
+	for (i = noteset_next (&event->off, 0); i >= 0; i = noteset_next (&event->off, i + 1)) release_note ((uint8_t) i);
+#ifdef TETRACHORDER_LATENCY_PROBE
+	if (!noteset_is_empty (&event->on)) latency_note_processed (active_count == 0);
+#endif
+	// retrigger, or play on a free or stolen channel
+	for (i = noteset_next (&event->on, 0); i >= 0; i = noteset_next (&event->on, i + 1)) play_note ((uint8_t) i);
+
+	if (event->bend != NO_CONTROL) set_pitch_bend (event->bend);
+	// MIDI volume is a squared curve
+	if (event->volume != NO_CONTROL) set_audio_rate_and_volume (SAMPLE_RATE, (uint16_t) ((VOLUME * event->volume * event->volume) / (127 * 127)));
+}
+
+
+// frame of the block where a chord change takes effect, or n if it is for a later block
+// chord changes are played one block duration after core0 published them: a chord change published while the previous
+// block was being played falls inside this block, at the same distance from its start, so the timing between chord
+// changes is kept to the sample (strums, arpeggios) and the delay is constant; late chord changes are played at frame 0
+static uint32_t event_frame (const ChordEvent *event, uint64_t block_time, uint32_t n) {
+
+	uint64_t due = event->time + (uint64_t) n * 1000000 / SAMPLE_RATE;
+	if (due <= block_time) return 0;
+	uint64_t frame = (due - block_time) * SAMPLE_RATE / 1000000;
+	return (frame < n) ? (uint32_t) frame : n;
+}
+
+
+// render callback: the block is split at the frames where chord changes received from core0 take effect, and all the
+// notes of a chord change start on the same sample
+// when several buffers are rendered in a row (eg. the audio interrupt catches up on free buffers), each block plays one
+// block duration after the previous one: its time follows from the previous block, and not from the clock, which has
+// hardly moved; the clock is used again as soon as it reaches the expected time (within half a block)
+static void render_block (int16_t *samples, uint32_t n) {
+	static ChordEvent event;			// next chord change, if it has been read from the ring but is for a later frame
+	static bool event_waiting = false;
+	static uint64_t next_block_time = 0;	// expected time of the next block: time of this block + its duration
+	uint64_t duration = (uint64_t) n * 1000000 / SAMPLE_RATE;
+	uint64_t now = time_us_64 ();
+	uint64_t block_time = (now + duration / 2 >= next_block_time) ? now : next_block_time;
+	uint32_t done = 0;
 
-	uint32_t data;
-	uint8_t *midi;
-	int i,j;
-	bool found;
+	next_block_time = block_time + duration;
+
+	while (true) {
+		if (!event_waiting) event_waiting = event_ring_pop (&event);
+		uint32_t frame = event_waiting ? event_frame (&event, block_time, n) : n;
+
+		if (frame > done) {
+			render_audio_block (samples + done, frame - done);
+			done = frame;
+		}
+		if (done == n) break;			// end of block: a chord change for a later block stays waiting
+
+		apply_chord_event (&event);
+		event_waiting = false;
+	}
+}
+
+
+void core1_main() {		//The program running on core 1
 
 	// configure audio
 	struct audio_buffer_pool *ap = init_audio();
 	set_audio_rate_and_volume (SAMPLE_RATE, VOLUME);	// set audio rate & volume at synthetizer level
 	reset_playback_all ();								// at start, stop all audio channels and set all channels to inactive
+#ifdef TETRACHORDER_BENCH
+	bench_wavetables ();								// render benchmarks, results are printed on UART
+	bench_synth ();
+	bench_mix_paths ();
+#endif
+
+#if AUDIO_IRQ_RENDER
+	// audio buffers are rendered, and chord changes applied, in the DMA interrupt: core1 sleeps otherwise
+	// chord changes are not applied by this loop when they arrive: render_block() plays each of them at its frame in the
+	// block, one block duration after core0 published it, so the delay from keypad to sound is constant and the timing
+	// between chord changes is kept to the sample; applying them here would start notes at the position the block being
+	// rendered happens to be at, ie. with a jitter of up to one block
+	// this loop does the work which is not bound to a sample: copies of waveforms to SRAM, and latency reports
+	start_audio_irq (ap, render_block);
 
 	while (true) {
-		if (queue_try_remove(&synth_queue, &data)) {
-			// Perform processing here
-			midi = (uint8_t *) &data;		// read 32-bit data as 4 bytes of 8-bit
-
-			// analyse midi data and play accordingly
-			switch (midi[1] & 0xF0) {
-				case MIDI_PGMCHANGE:
-					instrument_task (midi[2]);
-				break;
-
-				case MIDI_NOTEOFF:
-					for (i = 0; i < CHANNEL_COUNT; i++) {
-						if (channels[i].midi_note == midi[2]) {
-							// stop channel, set inactive
-							stop_playback (i);
-						}
-					}
-				break;
-
-				case MIDI_NOTEON:
-					found = false;
-					// check if the same note is being played already (still in ADSR); if so, then trigger attack again
-					for (i = 0; i < CHANNEL_COUNT; i++) {
-						if ((channels[i].adsr_phase != ADSR_OFF) && (channels[i].midi_note == midi[2])) {
-							// channel plays same note already: let's use it and attack again!
-							update_playback (i, midi[2], true);
-							found = true;
-							break;			// assign note to a single channel, then move to next note
-						}
-					}
-					if (found) break;		// if we play the note, then leave
-
-					// in case the same note is not being played already, find an empty channel to play note
-					for (i = 0; i < CHANNEL_COUNT; i++) {
-						if (channels[i].adsr_phase == ADSR_OFF) {
-							// empty channel: let's use it and play!
-							update_playback (i, midi[2], false);
-							break;			// assign note to a single channel, then move to next note
-						}
-					}
-				break;
-			}
-		}
-		else {
-            // printf("Queue is empty.\n");
-		}
+		__wfe ();		// woken up by the audio interrupt
+		load_wavetables ();	// copy to SRAM the waveforms of an instrument changed by the interrupt, if any
+#ifdef TETRACHORDER_LATENCY_PROBE
+		latency_report ();
+#endif
+	}
+#else
+	while (true) {
+#ifdef TETRACHORDER_LATENCY_PROBE
+		latency_report ();
+#endif
 
 		// update audio buffer : make sure we do this regularly (in while loop)
-	   	update_buffer(ap, get_audio_frame);
+	   	update_buffer(ap, render_block);
+		load_wavetables ();
 	}
+#endif
 }
\ No newline at end of file
@@ -2,15 +2,22 @@
 #define PLAY_H
 
 #include "pico/stdlib.h"
+#include "event_ring.h"
 
 
 void update_playback (int, uint8_t, bool);
 void stop_playback (int);
 void reset_playback (int);
 void reset_playback_all ();
+void play_note (uint8_t);
+void release_note (uint8_t);
 bool load_instrument(int, int);
+void set_wavetables_in_ram (bool);
+bool load_wavetables ();
+int get_instrument_count ();
 void song_task();
 void instrument_task(int);
+void apply_chord_event (const ChordEvent *);
 void core1_main();
 
 #endif
\ No newline at end of file
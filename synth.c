@@ -7,8 +7,7 @@
 #include "globals.h"
 #include "audio.h"
 #include "synth.h"
-
-extern const int16_t waveforms[64][8][256];
+#include "voice_alloc.h"
 
 
 uint32_t prng_xorshift_state = 0x32B71700;
@@ -33,18 +32,62 @@ int32_t prng_normal() {
 uint32_t sample_rate;   // Sample rate definition
 uint16_t volume;        // Global volume
 
+uint32_t active_mask = 0;               // bitmask of active channels
+uint8_t active_list[CHANNEL_COUNT];     // dense list of active channels
+int active_count = 0;                   // number of active channels
+static uint8_t active_pos[CHANNEL_COUNT];  // position of each active channel in active_list
+static uint8_t note_channel[128];       // channel number + 1 assigned to each midi note, 0 if no channel
+
+// add a channel to the active channels (does nothing if the channel is active already)
+static void activate_channel(AudioChannel* channel) {
+    int c = channel - channels;
+
+    if (active_mask & (1u << c)) return;
+    active_mask |= (1u << c);
+    active_pos [c] = active_count;
+    active_list [active_count++] = c;
+    channel_taken (c);                  // channel is not free anymore
+}
+
+// remove a channel from the active channels (does nothing if the channel is inactive already)
+// last channel of the list takes the place of the removed one, so the list stays dense
+static void deactivate_channel(AudioChannel* channel) {
+    int c = channel - channels;
+
+    if (!(active_mask & (1u << c))) return;
+    active_mask &= ~(1u << c);
+    int last = active_list [--active_count];
+    active_list [active_pos [c]] = last;
+    active_pos [last] = active_pos [c];
+    channel_freed (c);                  // channel is free again
+}
+
 void set_audio_rate_and_volume (uint32_t rate, uint16_t vol) {
     sample_rate = rate;
     volume = vol;
 }
 
+// assign a midi note to a channel: the former note of the channel is unassigned
+void assign_note(AudioChannel* channel, uint8_t note) {
+    int c = channel - channels;
+
+    if (note_channel [channel->midi_note] == c + 1) note_channel [channel->midi_note] = 0;
+    channel->midi_note = note;
+    note_channel [note] = c + 1;
+}
+
+// get the channel playing a midi note (whatever its ADSR phase), or NO_CHANNEL
+int get_note_channel(uint8_t note) {
+    return (int) note_channel [note & 0x7F] - 1;
+}
+
 bool is_audio_playing() {
     if (volume == 0) {
         return false;
     }
 
-    for (int c = 0; c < CHANNEL_COUNT; c++) {
-        if (channels[c].volume > 0 && channels[c].adsr_phase != ADSR_OFF) {
+    for (int i = 0; i < active_count; i++) {
+        if (channels[active_list[i]].volume > 0) {
             return true;
         }
     }
@@ -52,24 +95,64 @@ bool is_audio_playing() {
     return false;
 }
 
-int16_t get_audio_frame() {
-    int32_t sample = 0; // Used to combine channel output
+#if defined(TETRACHORDER_BENCH) || defined(TETRACHORDER_HOST)
+// mix arithmetic, for the A/B benchmark of bench_mix_paths(): the 32-bit path is the one of the firmware
+static MixPath mix_path = MIX_32BIT;
+
+void set_mix_path(MixPath path) {
+    mix_path = path;
+}
+
+// former mix arithmetic of a channel, for one envelope period: ADSR volume and channel volume are applied to each sample
+// with two 64-bit multiplies (library calls on Cortex-M0+), and ADSR volume ramps from adsr_start to adsr_end
+static uint32_t render_period_int64(const int16_t *table, uint32_t offset, uint32_t increment, uint32_t adsr_start,
+    uint32_t adsr_end, int32_t vol, int32_t *out, uint32_t len) {
     int32_t channel_sample;
-	int index = 0;
+    uint32_t adsr = adsr_start;
+    int32_t adsr_step = ((int32_t)adsr_end - (int32_t)adsr_start) / (int32_t)len;
+
+    for (uint32_t k = 0; k < len; k++) {
+        offset += increment;
+        channel_sample = (int32_t)(table [offset >> 24]);
+        channel_sample = ((int64_t)(channel_sample) * (int32_t)(adsr >> 8)) >> 16;
+        channel_sample = ((int64_t)(channel_sample) * vol) >> 16;
+        adsr += adsr_step;
+        out [k] += channel_sample;
+    }
+    return offset;
+}
+#endif
+
+// mix buffer for the block being rendered: all channels are accumulated here in 32-bit before final scaling and clipping
+static int32_t mix_buffer[SAMPLES_PER_BUFFER];
+
+// end of the fade-out of a stolen channel: play the pending note from the start
+static void start_pending_note(AudioChannel* channel) {
+    channel->note_pending = false;
+    channel->midi_note = channel->pending_note;         // note has been assigned to the channel already by steal_channel()
+    channel->phase_increment = channel->pending_increment;
+    channel->table = channel->pending_table;
+    trigger_attack(channel);
+    channel_renewed (channel - channels);               // channel is active already: its note starts now
+}
 
-    for (int c = 0; c < CHANNEL_COUNT; c++) {
-        AudioChannel* channel = &channels[c];
-        channel_sample = 0;
+// add one channel to the mix buffer, for n samples
+// the ADSR envelope is evaluated at control rate, once every ENVELOPE_RATE samples: phase transitions are checked and the
+// envelope is advanced once per period, and the gain ramps linearly from the start to the end of the period inside it
+// this keeps the per-sample loop free of the envelope logic
+static void render_channel(AudioChannel* channel, int32_t *mix, uint32_t n) {
+    int32_t channel_sample;
+    const int16_t *table = channel->table;              // waveform is chosen from the note when the note starts, not for each sample
 
-        // Increment the waveform position counter
-        // we do over-sampling, ie. instead of 256 samples per waveform, we consider to have 256 >> 8 = 65536 (16-bits)
-        channel->waveform_offset += ((channel->frequency * SAMPLES_PER_BUFFER) << 8) / sample_rate;
+    // phase is a 32-bit accumulator: it wraps around by itself at the end of the waveform, and its top 8 bits are the index of the sample
+    uint32_t increment = channel->phase_increment;
+    uint32_t offset = channel->waveform_offset;
+    uint32_t vol = channel->volume;
 
-        if (channel->adsr_phase == ADSR_OFF) {      // in case channel is inactive (not playing), then leave
-            continue;
-        }
+    for (uint32_t i = 0; i < n; i += ENVELOPE_RATE) {
+        uint32_t len = MIN (ENVELOPE_RATE, n - i);      // number of samples in this envelope period (last one of the block may be shorter)
 
-        // Check ADSR phase transitions
+        // Check ADSR phase transitions (at the start of an envelope period)
         if (channel->adsr_frame >= channel->adsr_end_frame) {
             switch (channel->adsr_phase) {
                 case ADSR_ATTACK:
@@ -82,99 +165,160 @@ int16_t get_audio_frame() {
                     trigger_release(channel);
                     break;
                 case ADSR_RELEASE:
-                    off(channel);
+                    if (channel->note_pending) {
+                        // stolen channel has faded out: it now plays its new note, from the start
+                        start_pending_note(channel);
+                        table = channel->table;
+                        increment = channel->phase_increment;
+                        offset = channel->waveform_offset;
+                    }
+                    else off(channel);
                     break;
                 default:
                     break;
             }
+            // channel is now inactive: the rest of the block is silent for this channel
+            if (channel->adsr_phase == ADSR_OFF) return;
         }
 
-        channel->adsr += channel->adsr_step;
-        channel->adsr_frame++;                  // number of frames into the current ADSR phase
-        channel->waveform_offset &= 0xffff;
-
-        // check if channel frequency is 0; if so, then sample shall be 0
-        if (channel->frequency == 0) channel_sample =0;
-        // if channel frequency is not 0, then process sample
-        else {
-			// get the value of sample from the waveform
-			// select the waveform from value of midi_note
-			// there are different waveforms so that higher notes get let's harmonics than lower range notes (waveforms are simpler)
-			// this is a design characteristic of Korg DW8000 synthetizer
-			if ((channel->midi_note <= 35)) index = 0;										// notes between C-2 and B0
-			if ((channel->midi_note >= 36) && (channel->midi_note <= 47)) index = 1;		// notes between C1 and B1
-			if ((channel->midi_note >= 48) && (channel->midi_note <= 59)) index = 2;		// notes between C2 and B2
-			if ((channel->midi_note >= 60) && (channel->midi_note <= 71)) index = 3;		// notes between C3 and B3
-			if ((channel->midi_note >= 72) && (channel->midi_note <= 83)) index = 4;		// notes between C4 and B4
-			if ((channel->midi_note >= 84) && (channel->midi_note <= 95)) index = 5;		// notes between C5 and B5
-			if ((channel->midi_note >= 96) && (channel->midi_note <= 107)) index = 6;		// notes between C6 and B6
-			if ((channel->midi_note >= 108)) index = 7;										// notes between C7 and G8
-
-			channel_sample = (int32_t)(waveforms [channel->waveforms][index][(channel->waveform_offset) >> 8]);		// get sample from sample array                  
-        }
+        // advance the envelope by one period: it follows the ADSR ramp up to the end of the phase, and then holds its value
+        // until the transition at the start of next period, so it never goes beyond the target of the phase
+        uint32_t frames = MIN (len, channel->adsr_end_frame - MIN (channel->adsr_frame, channel->adsr_end_frame));
+        uint32_t adsr_start = channel->adsr;
+        uint32_t adsr_end = adsr_start + channel->adsr_step * (int32_t)frames;
+        channel->adsr = adsr_end;
+        channel->adsr_frame += len;             // number of frames into the current ADSR phase
+
+        // check if channel frequency is 0; if so, then channel is silent
+        if (increment == 0) continue;
 
         // Scale by ADSR and volume
         // channel sample at this stage is signed 16-bits
         // it looks as if channel->adsr is actually unsigned 24-bit, but expressed on 32-bit
         // channel->adsr is the real-time volume at which the sample should be played (0x0000-0xffffff)
         // given we shift channel->adsr of 8-bit (>>8), then it is 16-bit
-        // signed 16-bit * 16-bit = signed 32-bit (but we store it in a 64-bit variable); then we make it signed 16-bit again
-        // We do the same for channel volume, except that channel volume is on unsigned 16-bit, so no need to >>8.
-        // this is fine to shift >>8 and >>16 because C compiler propagates the sign bit, ie. incoming bits to the left will
+        // ADSR volume (16-bit) and channel volume (16-bit) are first combined in a single 16-bit gain: unsigned 16-bit * 16-bit = 32-bit
+        // gain is computed at both ends of the period, and ramps linearly in between; it is kept with 8 more bits of accuracy (Q8)
+        // then signed 16-bit sample * unsigned 16-bit gain fits in a signed 32-bit; then we make it signed 16-bit again
+        // everything stays in 32-bit: no 64-bit multiply (which is a library call on Cortex-M0+)
+        // this is fine to shift >>16 because C compiler propagates the sign bit, ie. incoming bits to the left will
         // be 1 to keep the sign bit.
+        int32_t gain = (int32_t)(((adsr_start >> 8) * vol) >> 16) << 8;
+        int32_t gain_end = (int32_t)(((adsr_end >> 8) * vol) >> 16) << 8;
+        int32_t gain_step = (len == ENVELOPE_RATE) ? ((gain_end - gain) >> ENVELOPE_SHIFT) : ((gain_end - gain) / (int32_t)len);
+        int32_t *out = mix + i;
+
+#if defined(TETRACHORDER_BENCH) || defined(TETRACHORDER_HOST)
+        if (mix_path == MIX_INT64) {
+            offset = render_period_int64(table, offset, increment, adsr_start, adsr_end, (int32_t)vol, out, len);
+            continue;
+        }
+#endif
+        for (uint32_t k = 0; k < len; k++) {
+            // Increment the waveform position counter, and get sample from sample array
+            offset += increment;
+            channel_sample = (int32_t)(table [offset >> 24]);
+            channel_sample = (channel_sample * (gain >> 8)) >> 16;
+            gain += gain_step;
+
+            // Combine channel sample into the final sample
+            // here, we have say 16 channels. Suppose all the channel samples are up to the max,
+            // this makes 16*0x7fff = 0x80008 (=20 bits if positive); but in 32-bit (sample is 32-bit)
+            // this makes 0x00080008 for all samples positive to the max, and 0xFFFFFF80 for all samples negative to the min
+            out [k] += channel_sample;
+        }
+    }
+
+    // store the channel state back
+    channel->waveform_offset = offset;
+}
 
-        channel_sample = ((int64_t)(channel_sample) * (int32_t)(channel->adsr >> 8)) >> 16;
-        channel_sample = ((int64_t)(channel_sample) * (int32_t)(channel->volume)) >> 16;
+// render n samples of all channels (n <= SAMPLES_PER_BUFFER)
+static void render_mix(int16_t *out, uint32_t n) {
+    int32_t sample;
 
+    for (uint32_t i = 0; i < n; i++) mix_buffer [i] = 0;
 
-        // Combine channel sample into the final sample
-        // here, we have say 16 channels. Suppose all the channel samples are up to the max,
-        // this makes 16*0x7fff = 0x80008 (=20 bits if positive); but in 32-bit (sample is 32-bit)
-        // this makes 0x00080008 for all samples positive to the max, and 0xFFFFFF80 for all samples negative to the min
-        sample += channel_sample;
+    // channel-major: each active channel is rendered for the whole block, then the next channel; inactive channels cost nothing
+    // list is walked backwards: if a channel ends during the block, off() moves the last channel of the list to its place,
+    // and this last channel has been rendered already
+    for (int i = active_count - 1; i >= 0; i--) {
+        render_channel (&channels[active_list[i]], mix_buffer, n);
     }
-    // given signed 20-bit (sample) * unsigned 16-bit (volume) requires a result on 37-bit, we need a 64-bit temp variable
-    // then shift to take only the MSB; no problem with signed operation, the C compiler keeps the sign when shifting bits.
-    // we want a 16-bit result from a 37-bit value, ie. we have to shift 21 bits
+
+    // given signed 20-bit (sample) * unsigned 16-bit (volume) requires a result on 37-bit, it does not fit in 32-bit
+    // so volume is split in its high and low bytes: sample * volume = ((sample * volume_hi) << 8) + (sample * volume_lo)
+    // each product is at most 21-bit * 8-bit = 29-bit (up to 32 channels), which fits in 32-bit
+    // we want a 16-bit result from a 37-bit value, ie. we have to shift 20 bits: 8 bits for the low byte product, then 12 bits
+    // this gives exactly the same result as a 64-bit multiply followed by >>20
+    // no problem with signed operation, the C compiler keeps the sign when shifting bits.
     // if number of channels is between 9 and 31, sample will be coded in 20-bit (result = 37-bit); requiring in the end a shift >>21.
     // if number of channels is lower or equal to 8, sample will be coded in 19-bit (result = 35-bit); requiring in the end a shift >>19.
+    // we shift >>20: we increase volume and accuracy, and will tolerate a bit of clipping
     // in the end, sample is on 16-bit signed.
-//    sample = ((int64_t)(sample) * (int32_t)(volume)) >> 21;
-    sample = ((int64_t)(sample) * (int32_t)(volume)) >> 20; // we increase volume and accuracy, and will tolerate a bit of clipping
-
+    int32_t volume_hi = volume >> 8;
+    int32_t volume_lo = volume & 0xff;
+
+#if defined(TETRACHORDER_BENCH) || defined(TETRACHORDER_HOST)
+    if (mix_path == MIX_INT64) {
+        for (uint32_t i = 0; i < n; i++) {
+            sample = ((int64_t)(mix_buffer [i]) * (int32_t)(volume)) >> 20;
+            out [i] = (sample <= -0x8000) ? -0x8000 : ((sample > 0x7fff) ? 0x7fff : sample);
+        }
+        return;
+    }
+#endif
+    for (uint32_t i = 0; i < n; i++) {
+        sample = mix_buffer [i];
+        sample = ((sample * volume_hi) + ((sample * volume_lo) >> 8)) >> 12;
 
-/* debug only
-    // Clip result to 16-bit
-    if (sample < -0x8000) {
-        printf ("clipping low\n");
-        sample = -0x8000;
+        // Clip result to 16-bit, once per sample of the block
+        out [i] = (sample <= -0x8000) ? -0x8000 : ((sample > 0x7fff) ? 0x7fff : sample);
     }
-    if (sample > 0x7fff) {
-        printf ("clipping high\n");
-        sample = 0x7fff;
+}
+
+// render a block of n samples into out; this is the entry point used to fill audio buffers
+void render_audio_block(int16_t *out, uint32_t n) {
+    while (n > 0) {
+        uint32_t len = MIN (n, SAMPLES_PER_BUFFER);
+        render_mix (out, len);
+        out += len;
+        n -= len;
     }
-*/
-    sample = (sample <= -0x8000) ? -0x8000 : ((sample > 0x7fff) ? 0x7fff : sample);
+}
+
+// compatibility shim for per-sample callers: render a block of 1 sample
+int16_t get_audio_frame() {
+    int16_t sample;
+
+    render_audio_block (&sample, 1);
     return sample;
 }
 
 void retrigger_attack(AudioChannel* channel)  {     // re-trigger attack from a note that was already playing, in an ADSR phase already
                                                     // in this case, ADSR volume should not start from 0 but from current volume
-    int i=0;
     uint32_t frame = 0;
-    uint32_t adsr = 0;
+    uint32_t adsr = channel->adsr;
 
     channel->adsr_phase = ADSR_ATTACK;
     channel->adsr_end_frame = (channel->attack_ms * sample_rate) / 1000;    // frame target at which the ADSR changes to the next phase
 //    channel->adsr_step = ((int32_t)(0xffffff) - (int32_t)(channel->adsr)) / (int32_t)(channel->adsr_end_frame); // volume increment of current sample
     channel->adsr_step = (int32_t)(0xffffff) / (int32_t)(channel->adsr_end_frame); // volume increment of current sample
     // based on current adsr (volume of current sample, compute the current adsr_frame (ie. frame number into the current ADSR phase))
-    while (adsr < channel->adsr) {
-        frame++;
-        adsr +=channel->adsr_step;
+    // this is the first frame of the attack ramp whose volume is not below current volume: frame = ceil (adsr / step)
+    // a single 32-bit division, done by the RP2040 hardware divider (instead of counting frames one by one up to the current volume)
+    if (channel->adsr_step > 0) {
+        uint32_t step = (uint32_t) channel->adsr_step;
+        frame = (adsr + step - 1) / step;
+        adsr = frame * step;
+        // the snap may go up to step - 1 beyond the current volume: ADSR volume stays 24-bit, as the 32-bit gain of
+        // render_channel() overflows beyond 0xffffff
+        if (adsr > 0xffffff) adsr = 0xffffff;
     }
     channel->adsr_frame = frame;                // number of frames into the current ADSR phase
     channel->adsr = adsr;
+    activate_channel(channel);
+    channel_renewed (channel - channels);       // note starts again: the channel is not the oldest one anymore
 }
 
 void trigger_attack(AudioChannel* channel)  {   // trigger attack from 0 (note was not playing already)
@@ -185,6 +329,7 @@ void trigger_attack(AudioChannel* channel)  {   // trigger attack from 0 (note w
     channel->adsr_end_frame = (channel->attack_ms * sample_rate) / 1000;    // frame target at which the ADSR changes to the next phase
 //    channel->adsr_step = ((int32_t)(0xffffff) - (int32_t)(channel->adsr)) / (int32_t)(channel->adsr_end_frame); // volume increment of current sample
     channel->adsr_step = (int32_t)(0xffffff) / (int32_t)(channel->adsr_end_frame); // volume increment of current sample
+    activate_channel(channel);
 }
 
 void trigger_decay(AudioChannel* channel) {
@@ -208,9 +353,42 @@ void trigger_release(AudioChannel* channel) {
     channel->adsr_step = ((int32_t)(0) - (int32_t)(channel->adsr)) / (int32_t)(channel->adsr_end_frame);
 }
 
+void trigger_fade(AudioChannel* channel) {      // short release, used when a channel is stolen
+    channel->adsr_frame = 0;
+    channel->adsr_phase = ADSR_RELEASE;
+    channel->adsr_end_frame = (STEAL_FADE_MS * sample_rate) / 1000;
+    channel->adsr_step = ((int32_t)(0) - (int32_t)(channel->adsr)) / (int32_t)(channel->adsr_end_frame);
+}
+
 void off(AudioChannel* channel) {
     channel->adsr_frame = 0;
     channel->adsr = 0;
     channel->adsr_phase = ADSR_OFF;
     channel->adsr_step = 0;
+    cancel_pending_note(channel);
+    deactivate_channel(channel);
+    // the channel does not play its note anymore
+    if (note_channel [channel->midi_note] == (channel - channels) + 1) note_channel [channel->midi_note] = 0;
+}
+
+// steal a busy channel to play a new note: the channel fades out quickly, then plays the new note
+// the former note is unassigned at once, and the new note is assigned to the channel at once (so NOTEOFF of the new note finds it)
+void steal_channel(AudioChannel* channel, uint8_t note, uint32_t phase_increment, const int16_t *table) {
+    int c = channel - channels;
+
+    cancel_pending_note(channel);
+    if (note_channel [channel->midi_note] == c + 1) note_channel [channel->midi_note] = 0;
+    note_channel [note] = c + 1;
+    channel->pending_note = note;
+    channel->pending_increment = phase_increment;
+    channel->pending_table = table;
+    channel->note_pending = true;
+    trigger_fade(channel);
+}
+
+// forget the pending note of a stolen channel (eg. NOTEOFF received during the fade-out): the channel just fades out
+void cancel_pending_note(AudioChannel* channel) {
+    if (!channel->note_pending) return;
+    channel->note_pending = false;
+    if (note_channel [channel->pending_note] == (channel - channels) + 1) note_channel [channel->pending_note] = 0;
 }
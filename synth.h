@@ -50,9 +50,16 @@
 
 
 #define CHANNEL_COUNT 16          // 4 notes + bass + 9th + 11th = 7 channels * 2 = 14; let's make it 16
+#if CHANNEL_COUNT > 32
+#error "CHANNEL_COUNT shall be 32 or lower, as active channels are kept in a 32-bit mask"
+#endif
+#define ALL_CHANNELS_MASK ((CHANNEL_COUNT == 32) ? 0xFFFFFFFFu : ((1u << CHANNEL_COUNT) - 1))
 
 #define PI 3.14159265358979323846f
 
+#define ENVELOPE_SHIFT 4
+#define ENVELOPE_RATE (1 << ENVELOPE_SHIFT)   // ADSR envelopes are evaluated once every 16 samples (control rate), and ramp linearly in between
+
 typedef enum {
     ADSR_ATTACK,
     ADSR_DECAY,
@@ -63,7 +70,7 @@ typedef enum {
 
 typedef struct {
     uint8_t waveforms;                // # of waveform
-    uint16_t frequency;               // Frequency of the voice (Hz)
+    const int16_t *table;             // Waveform played by the channel, from instrument and midi note
     uint16_t volume;                  // Channel volume
     uint8_t midi_note;                // MIDI note played on the channel
 
@@ -73,7 +80,8 @@ typedef struct {
     uint16_t sustain_ms;              // Sustain period
     uint16_t release_ms;              // Release period
 
-    uint32_t waveform_offset;         // Voice offset (Q8)
+    uint32_t phase_increment;         // Phase step per sample (Q8.24), from the note
+    uint32_t waveform_offset;         // Voice phase (Q8.24): the top 8 bits index the waveform
 
     int32_t filter_last_sample;       // Last sample for filter
     bool filter_enable;               // Filter status
@@ -84,17 +92,49 @@ typedef struct {
     uint32_t adsr;                    // Current ADSR value
     int32_t adsr_step;                // ADSR step value
     ADSRPhase adsr_phase;             // Current ADSR phase
+
+    bool note_pending;                // Channel has been stolen: it fades out, then plays pending_note
+    uint8_t pending_note;             // MIDI note to be played at the end of the fade-out
+    uint32_t pending_increment;       // Phase step of pending_note
+    const int16_t *pending_table;     // Waveform of pending_note
 } AudioChannel;
 
+// active channels (ie. not in ADSR_OFF phase), kept up to date by trigger_attack() and off()
+// they are available both as a bitmask, and as a dense list of channel numbers so that only sounding channels are rendered
+extern uint32_t active_mask;                    // bit n is set if channel n is active
+extern uint8_t active_list[CHANNEL_COUNT];      // channel numbers of active channels, in no particular order
+extern int active_count;                        // number of active channels in active_list
+
+// channel assigned to each midi note, so NOTEOFF and retrigger find their channel without scanning channels
+// a note is assigned to a channel by assign_note(), and unassigned when the channel goes off or plays another note
+#define NO_CHANNEL -1
+
 void set_audio_rate_and_volume (uint32_t, uint16_t);
+void render_audio_block(int16_t *, uint32_t);
 int16_t get_audio_frame(void);
 bool is_audio_playing(void);
 
+#if defined(TETRACHORDER_BENCH) || defined(TETRACHORDER_HOST)
+// mix arithmetic of render_audio_block(), for benchmarks: 32-bit gains (firmware), or the former 64-bit multiplies
+typedef enum {
+    MIX_32BIT,
+    MIX_INT64
+} MixPath;
+
+void set_mix_path(MixPath path);
+#endif
+
+void assign_note(AudioChannel* channel, uint8_t note);
+int get_note_channel(uint8_t note);
+
 void retrigger_attack(AudioChannel* channel);
 void trigger_attack(AudioChannel* channel);
 void trigger_decay(AudioChannel* channel);
 void trigger_sustain(AudioChannel* channel);
 void trigger_release(AudioChannel* channel);
+void trigger_fade(AudioChannel* channel);
 void off(AudioChannel* channel);
+void steal_channel(AudioChannel* channel, uint8_t note, uint32_t phase_increment, const int16_t *table);
+void cancel_pending_note(AudioChannel* channel);
 
 #endif // SYNTH_H
@@ -0,0 +1,114 @@
+#include "pico/stdlib.h"
+#include <stdint.h>
+#include <stdio.h>
+
+#include "audio.h"
+#include "telemetry.h"
+
+
+// counters are written by the render core only, and read by any core: 32-bit counters are read in one access, only the
+// 64-bit render total (used for the mean) may be read while being updated
+static volatile uint32_t blocks = 0;
+static volatile uint32_t render_last = 0;
+static volatile uint32_t render_worst = 0;
+static volatile uint64_t render_total = 0;
+static volatile uint32_t block_duration = 0;
+static volatile uint32_t deadline_misses = 0;
+static volatile uint32_t underruns = 0;
+static volatile uint32_t fill_last = 0;
+static volatile uint32_t fill_lowest = 0xFFFFFFFF;
+
+
+// a block of samples has been rendered in render_us, and given to the output while fill buffers were waiting to be played
+void telemetry_block(uint32_t render_us, uint32_t samples, uint32_t fill) {
+
+    block_duration = samples * 1000000 / SAMPLE_RATE;
+    blocks++;
+    render_last = render_us;
+    render_total += render_us;
+    if (render_us > render_worst) render_worst = render_us;
+    if (render_us > block_duration) deadline_misses++;
+    fill_last = fill;
+    if (fill < fill_lowest) fill_lowest = fill;
+}
+
+// the output had no rendered buffer to play
+void telemetry_underrun() {
+    underruns++;
+}
+
+// restart the counters: to be called by the render core, eg. when the buffer geometry changes
+void telemetry_reset() {
+    blocks = 0;
+    render_last = 0;
+    render_worst = 0;
+    render_total = 0;
+    deadline_misses = 0;
+    underruns = 0;
+    fill_last = 0;
+    fill_lowest = 0xFFFFFFFF;
+}
+
+
+// copy the counters, in the order of TelemetryCounter
+void telemetry_read(uint32_t *counters) {
+    uint32_t n = blocks;
+
+    counters[TELEMETRY_BLOCKS] = n;
+    counters[TELEMETRY_RENDER_LAST] = render_last;
+    counters[TELEMETRY_RENDER_WORST] = render_worst;
+    counters[TELEMETRY_RENDER_MEAN] = n ? (uint32_t) (render_total / n) : 0;
+    counters[TELEMETRY_BLOCK_DURATION] = block_duration;
+    counters[TELEMETRY_DEADLINE_MISSES] = deadline_misses;
+    counters[TELEMETRY_UNDERRUNS] = underruns;
+    counters[TELEMETRY_FILL_LAST] = fill_last;
+    counters[TELEMETRY_FILL_LOWEST] = n ? fill_lowest : 0;
+    get_audio_buffers(&counters[TELEMETRY_BUFFER_COUNT], &counters[TELEMETRY_BUFFER_SAMPLES]);
+}
+
+
+void telemetry_print() {
+    uint32_t c[TELEMETRY_COUNTERS];
+
+    telemetry_read(c);
+    printf("audio: %lu blocks, render %lu us (worst %lu, mean %lu, deadline %lu), %lu deadline misses, %lu underruns\n",
+        (unsigned long) c[TELEMETRY_BLOCKS], (unsigned long) c[TELEMETRY_RENDER_LAST], (unsigned long) c[TELEMETRY_RENDER_WORST],
+        (unsigned long) c[TELEMETRY_RENDER_MEAN], (unsigned long) c[TELEMETRY_BLOCK_DURATION],
+        (unsigned long) c[TELEMETRY_DEADLINE_MISSES], (unsigned long) c[TELEMETRY_UNDERRUNS]);
+    printf("audio: fill %lu (lowest %lu), %lu buffers of %lu samples\n",
+        (unsigned long) c[TELEMETRY_FILL_LAST], (unsigned long) c[TELEMETRY_FILL_LOWEST],
+        (unsigned long) c[TELEMETRY_BUFFER_COUNT], (unsigned long) c[TELEMETRY_BUFFER_SAMPLES]);
+}
+
+
+// check whether a complete SysEx message (F0 ... F7) is a telemetry request
+bool telemetry_is_request(const uint8_t *sysex, uint32_t size) {
+    return (size == 4) && (sysex[0] == SYSEX_START) && (sysex[1] == SYSEX_MANUFACTURER) &&
+        (sysex[2] == SYSEX_TELEMETRY_REQUEST) && (sysex[3] == SYSEX_END);
+}
+
+// build the SysEx reply to a telemetry request; returns its size (TELEMETRY_SYSEX_SIZE)
+uint32_t telemetry_sysex(uint8_t *sysex) {
+    uint32_t c[TELEMETRY_COUNTERS];
+    uint32_t size = 0;
+
+    telemetry_read(c);
+    sysex[size++] = SYSEX_START;
+    sysex[size++] = SYSEX_MANUFACTURER;
+    sysex[size++] = SYSEX_TELEMETRY_REPLY;
+    for (int i = 0; i < TELEMETRY_COUNTERS; i++) {
+        // SysEx data bytes are 7-bit
+        for (int b = 0; b < 5; b++) sysex[size++] = (c[i] >> (7 * b)) & 0x7F;
+    }
+    sysex[size++] = SYSEX_END;
+    return size;
+}
+
+// check whether a complete SysEx message is a buffer geometry request, and get the geometry
+bool telemetry_is_buffers_request(const uint8_t *sysex, uint32_t size, uint32_t *count, uint32_t *samples) {
+    if ((size != 7) || (sysex[0] != SYSEX_START) || (sysex[1] != SYSEX_MANUFACTURER) ||
+        (sysex[2] != SYSEX_BUFFERS_REQUEST) || (sysex[6] != SYSEX_END)) return false;
+    *count = sysex[3];
+    *samples = sysex[4] | (sysex[5] << 7);
+    return true;
+}
@@ -0,0 +1,57 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "pico/stdlib.h"
+
+
+// Audio pipeline telemetry: counters are updated by the core which renders audio, for each block
+//
+// - render time of a block (last, worst, mean), timed with the RP2040 timer (us)
+// - deadline misses: blocks which took longer to render than to play
+// - underruns: audio DMA interrupts with no rendered buffer to play, so the output played silence (interrupt render mode)
+// - pool fill level: number of rendered buffers waiting to be played when a block is given to the output (last, lowest)
+//
+// counters are printed on UART by telemetry_print(), and sent back in reply to a USB MIDI SysEx request:
+//   request: F0 7D 01 F7
+//   reply:   F0 7D 02 <counters> F7, each counter (in the order of TelemetryCounter) as 5 bytes of 7 bits, LSB first
+//
+// the audio buffer geometry is changed by a USB MIDI SysEx message (no reply: the new geometry is in the next telemetry
+// reply, and counters restart with it):
+//   F0 7D 03 <count> <samples, low 7 bits> <samples, high 7 bits> F7     (2 to 4 buffers, 32 to 256 samples)
+
+#define SYSEX_START                 0xF0
+#define SYSEX_END                   0xF7
+#define SYSEX_MANUFACTURER          0x7D      // ID reserved for non-commercial use
+#define SYSEX_TELEMETRY_REQUEST     0x01
+#define SYSEX_TELEMETRY_REPLY       0x02
+#define SYSEX_BUFFERS_REQUEST       0x03
+
+typedef enum {
+    TELEMETRY_BLOCKS,               // number of blocks rendered
+    TELEMETRY_RENDER_LAST,          // render time of the last block (us)
+    TELEMETRY_RENDER_WORST,         // worst render time (us)
+    TELEMETRY_RENDER_MEAN,          // mean render time (us)
+    TELEMETRY_BLOCK_DURATION,       // playing time of a block (us): the render deadline
+    TELEMETRY_DEADLINE_MISSES,      // number of blocks whose render time exceeded the deadline
+    TELEMETRY_UNDERRUNS,            // number of times the output ran out of rendered buffers
+    TELEMETRY_FILL_LAST,            // buffers waiting to be played when the last block was given
+    TELEMETRY_FILL_LOWEST,          // lowest fill level
+    TELEMETRY_BUFFER_COUNT,         // current buffer geometry
+    TELEMETRY_BUFFER_SAMPLES,
+    TELEMETRY_COUNTERS              // number of counters
+} TelemetryCounter;
+
+#define TELEMETRY_SYSEX_SIZE (4 + 5 * TELEMETRY_COUNTERS)
+
+void telemetry_block(uint32_t render_us, uint32_t samples, uint32_t fill);
+void telemetry_underrun(void);
+void telemetry_reset(void);
+void telemetry_read(uint32_t *counters);
+void telemetry_print(void);
+bool telemetry_is_request(const uint8_t *sysex, uint32_t size);
+uint32_t telemetry_sysex(uint8_t *sysex);
+bool telemetry_is_buffers_request(const uint8_t *sysex, uint32_t size, uint32_t *count, uint32_t *samples);
+
+#endif // TELEMETRY_H
@@ -31,7 +31,6 @@
 #include "pico/binary_info.h"
 #include "hardware/pio.h"
 #include "pico/multicore.h"
-#include "pico/util/queue.h"
 
 // project-wide includes
 #include "tetrachorder.h"		// global variables init
@@ -53,13 +52,18 @@
 #include "synth.h"
 #include "chord.h"
 #include "play.h"
+#include "telemetry.h"
+#include "event_ring.h"
+#ifdef TETRACHORDER_LATENCY_PROBE
+#include "latency.h"
+#endif
 
 
 /***********************/
 /* Midi USB prototypes */
 /***********************/
 
-void midi_task();
+bool midi_task();
 
 
 /*************************************/
@@ -205,8 +209,7 @@ int main(void)
 	board_init();
 	printf("Tetrachorder\r\n");
 
-	// init multicore and queue for communication
-	queue_init(&synth_queue, sizeof(uint32_t), 256);	// Initialize a queue for 256 items of 4 bytes (uint32)
+	// init multicore: core0 sends chord changes to core1 through the event ring
 	multicore_launch_core1 (core1_main);				// Reset core1 for synth and and enter the core1_main function
 
 	// init device stack on configured roothub port
@@ -218,7 +221,9 @@ int main(void)
 
 	// Globals init
 	chord = create_chord ();	// create current chord to be played
-	reset_playback_all ();		// reset all synth channels to off
+	build_chord_table ();		// chord bitmap for each combination of modulation keys
+	build_interval_table ();	// intervals for each byte of a chord bitmap
+								// synth channels are reset by core1, which owns them (channel and voice lists are not shared between cores)
 
 	// Rotary encoder inits
 	rotary_encoder_t *encoder = create_encoder(2, 3, onchange);			// GPIO to be changed here
@@ -247,6 +252,8 @@ int main(void)
 
 
 	// main
+	chord_t played_chord;		// chord to be played: current chord, without its bass if bass is off
+
 	while (true) {
 		// Poll the keypad
 		// keypad_read(&keypad);
@@ -260,34 +267,35 @@ int main(void)
 		// b- we use a timer to detect when chord keys have been pressed, and take only into account the latest chord key pressed (based on "when" value);
 		// this is what we will do, and hopefully the timer is implemented in keypad.c already
 
-		keypad_read (&keypad);
-		for (int i = 0; i < 40; i++) {		// wait for 20ms: 40 * 500µs = 20ms
-			tud_task ();					// we shall call tud_task () every < 1ms
-			sleep_us (500);
-		}
+		keypad_read (&keypad);				// keypad is scanned in the background by PIO (or by a timer when PIO is not available): this does not wait
 
 		instrument = parse_keyboard (chord, &keypad);	// analyse key presses to get which chords has been selected
 
-		if (no_bass) reset_bass (chord);				// remove bass note in case we don't want to play it
+		// remove bass note in case we don't want to play it: on a copy, as parse_keyboard() keeps the chord until a key
+		// changes, so the bass comes back as soon as it is switched on again
+		played_chord = *chord;
+		if (no_bass) reset_bass (&played_chord);
 		// midi_notes that are contained in the chord
-		midi_notes_size = get_midi_notes (midi_notes, chord, voicing, voicing_bass);
-		// determine lists of notes which should be on / off, and list of notes that are common
-		midi_notes_common_size = cmp_midi_notes (midi_notes, midi_notes_size, former_midi_notes, former_midi_notes_size, true, midi_notes_common);
-		midi_notes_on_size = cmp_midi_notes (midi_notes, midi_notes_size, former_midi_notes, former_midi_notes_size, false, midi_notes_on);
-		midi_notes_off_size = cmp_midi_notes (former_midi_notes, former_midi_notes_size, midi_notes, midi_notes_size,  false, midi_notes_off);
+		get_midi_noteset (&midi_notes, &played_chord, voicing, voicing_bass);
+		// determine sets of notes which should be on / off, and set of notes that are common
+		noteset_and (&midi_notes_common, &midi_notes, &former_midi_notes);
+		noteset_andnot (&midi_notes_on, &midi_notes, &former_midi_notes);
+		noteset_andnot (&midi_notes_off, &former_midi_notes, &midi_notes);
 
 		tud_task(); 												// tinyusb device task
-		midi_task();												// manage midi tasks, send notes, send program select
+		if (midi_task ()) {											// manage midi tasks, send notes, send program select
+			// make new chord & instrument become former chord & instrument
+			// (if the synth could not take the chord change, former chord is kept so the change is sent next time)
+			former_instrument = instrument;
+			former_midi_notes = midi_notes;
+		}
+
+		if (getchar_timeout_us (0) == 't') telemetry_print ();		// audio telemetry on UART request
 
 // the 2 below calls are useless as we now communicate with core1 (synth) through midi_task()
 //		if (former_instrument != instrument) instrument_task (instrument);	// load new instrument if required
 //		song_task ();												// send to pico audio i2s board
 
-		// make new chord & instrument become former chord & instrument
-		former_instrument = instrument;
-		memcpy (former_midi_notes, midi_notes, midi_notes_size);
-		former_midi_notes_size = midi_notes_size;
-
 
 /* Neopixel part
 		// manage neopixel led strip: light the strip with the right color; in case of black, wait 150ms before unlighting
@@ -351,7 +359,117 @@ void tud_resume_cb(void)
 // MIDI Task
 //--------------------------------------------------------------------+
 
-void midi_task()
+// gather the bytes of an incoming SysEx message, and reply to the requests we know (telemetry, buffer geometry)
+static void receive_sysex (uint8_t const *packet, uint8_t cable_num)
+{
+	static uint8_t sysex [TELEMETRY_SYSEX_SIZE];
+	static uint32_t sysex_size = 0;
+	static bool overflow = false;		// message too long for the buffer: it is not one of ours
+	uint32_t count, samples;
+	int size;
+
+	switch (packet [0] & 0x0F) {
+		case CIN_SYSEX:			size = 3; break;
+		case CIN_SYSEX_END1:	size = 1; break;
+		case CIN_SYSEX_END2:	size = 2; break;
+		case CIN_SYSEX_END3:	size = 3; break;
+		default:				return;
+	}
+
+	for (int i = 1; i <= size; i++) {
+		if (packet [i] == SYSEX_START) {		// a new message starts
+			sysex_size = 0;
+			overflow = false;
+		}
+		if (sysex_size < sizeof (sysex)) sysex [sysex_size++] = packet [i];
+		else overflow = true;
+	}
+
+	if ((packet [0] & 0x0F) != CIN_SYSEX) {		// end of message
+		if (!overflow && telemetry_is_request (sysex, sysex_size)) {
+			sysex_size = telemetry_sysex (sysex);
+			tud_midi_stream_write (cable_num, sysex, sysex_size);
+		}
+		// core1 changes the geometry before it renders its next buffer
+		else if (!overflow && telemetry_is_buffers_request (sysex, sysex_size, &count, &samples)) request_audio_buffers (count, samples);
+		sysex_size = 0;
+		overflow = false;
+	}
+}
+
+
+// incoming channel messages for the synth (USB MIDI input), gathered into one record until they are published
+static ChordEvent midi_in_event;
+static bool midi_in_pending = false;		// midi_in_event holds messages which are not published yet
+
+// the synth has one channel per note for both sources: USB MIDI input and the keyboard (former_midi_notes, the notes of
+// the chord the synth plays); a note is released on the synth only when neither source holds it anymore
+static noteset_t midi_in_notes;				// notes held by USB MIDI input
+
+// publish the incoming messages gathered so far; returns false if the ring is full (they are kept for next time)
+static bool publish_midi_in ()
+{
+	if (!midi_in_pending) return true;
+	noteset_andnot (&midi_in_event.off, &midi_in_event.off, &former_midi_notes);	// notes held by the keyboard keep playing
+	midi_in_event.time = time_us_64 ();			// the synth plays the messages at the matching sample
+	if (!event_ring_push (&midi_in_event)) return false;
+	midi_in_pending = false;
+	return true;
+}
+
+// add a channel message to the record for the synth
+static void add_midi_in (uint8_t status, uint8_t data1, uint8_t data2)
+{
+	if (!midi_in_pending) chord_event_init (&midi_in_event);
+	if (!chord_event_add_midi (&midi_in_event, status, data1, data2)) {
+		// the message must be played after the record: the record is published first
+		// this cannot fail: midi_task() reads a packet only if the ring has room when a record is pending, and a packet
+		// publishes at most once (an empty record takes any message, and the note offs of all notes off go to a record
+		// with no note on after the first publish), so the return value is not checked
+		publish_midi_in ();
+		chord_event_init (&midi_in_event);
+		chord_event_add_midi (&midi_in_event, status, data1, data2);
+	}
+	midi_in_pending = !chord_event_is_empty (&midi_in_event);
+}
+
+// add a channel message received on midi_in_channel to the record for the synth, and keep track of the notes it holds
+static void receive_channel_message (uint8_t const *packet)
+{
+	uint8_t status = packet [1] & 0xF0;
+	int note;
+
+	switch (packet [0] & 0x0F) {
+		case CIN_NOTEOFF:
+		case CIN_NOTEON:
+		case CIN_CC:
+		case CIN_PGMCHANGE:
+		case CIN_PITCHBEND:
+			break;
+		default:
+			return;
+	}
+	if ((packet [1] & 0x0F) != midi_in_channel) return;
+
+	if ((status == MIDI_NOTEON) && (packet [3] & 0x7F)) noteset_add (&midi_in_notes, packet [2] & 0x7F);
+	else if ((status == MIDI_NOTEON) || (status == MIDI_NOTEOFF)) noteset_remove (&midi_in_notes, packet [2] & 0x7F);
+	else if ((status == MIDI_CC) && ((packet [2] & 0x7F) == 123)) {
+		// all notes off: only the notes of USB MIDI input are released, the chord of the keyboard keeps playing
+		for (note = noteset_next (&midi_in_notes, 0); note >= 0; note = noteset_next (&midi_in_notes, note + 1)) {
+			add_midi_in (MIDI_NOTEOFF | midi_in_channel, (uint8_t) note, 0);
+		}
+		noteset_clear (&midi_in_notes);
+		return;
+	}
+	// all sound off shuts all the channels down at once, the chord of the keyboard as well
+	else if ((status == MIDI_CC) && ((packet [2] & 0x7F) == 120)) noteset_clear (&midi_in_notes);
+
+	add_midi_in (packet [1], packet [2], packet [3]);
+}
+
+
+// returns false if the chord change could not be sent to the synth
+bool midi_task()
 {
 	uint8_t const cable_num = 0; // MIDI jack associated with USB endpoint
 
@@ -361,14 +479,19 @@ void midi_task()
 	// The MIDI interface always creates input and output port/jack descriptors
 	// regardless of these being used or not. Therefore incoming traffic should be read
 	// (possibly just discarded) to avoid the sender blocking in IO
-	// here, we check for note_on event, and if received, then we light the Neopixel strip
-	uint32_t *data;
+	// here, the channel messages on midi_in_channel are played by the synth, along with the chords of the keyboard
+	// packets are read only while the synth can take them: when the event ring is full, they wait in the USB FIFO, and
+	// the host waits in turn, so no message is dropped
 	uint8_t packet[4];
 	bool read = false;
 	int i;
 
-	while ( tud_midi_available() ) {
-		read = tud_midi_packet_read (packet);	// read midi EVENT (and we don't care)
+	while (!(midi_in_pending && event_ring_is_full ()) && tud_midi_available ()) {
+		read = tud_midi_packet_read (packet);	// read midi EVENT
+		if (read) {
+			receive_sysex (packet, cable_num);		// SysEx requests are answered
+			receive_channel_message (packet);		// channel messages go to the synth
+		}
 		
 		// byte 0 = cable number | Code Index Number (CIN)
 		// byte 1 = MIDI 0 
@@ -389,51 +512,56 @@ void midi_task()
 */
 
 	}
-
-	// check for program change
-	uint8_t pgm_change[4] = { (cable_num << 4) | CIN_PGMCHANGE, MIDI_PGMCHANGE | CHANNEL, 0, 0};
-	data = (uint32_t *) pgm_change;			// assign 32-bit data as 4 bytes of 8-bit
-
+	publish_midi_in ();			// if the ring is full, the messages are published next time
+
+	// chord change for the synth: program change, notes off and notes on are published as one record, before being sent
+	// to USB; if the ring is full, nothing is sent and the caller keeps its former chord, so the change is sent next time
+	ChordEvent event;
+	bool program = (force_instrument) || (instrument != former_instrument);
+
+	chord_event_init (&event);
+	event.program = program ? (int16_t) (instrument & 0x7F) : NO_PROGRAM;
+	noteset_andnot (&event.off, &midi_notes_off, &midi_in_notes);	// notes held by USB MIDI input keep playing
+	event.on = midi_notes_on;
+
+	if (program || !noteset_is_empty (&event.off) || !noteset_is_empty (&event.on)) {
+#ifdef TETRACHORDER_LATENCY_PROBE
+		if (!noteset_is_empty (&event.on)) latency_note_queued ();		// time of the chord, before it is published
+#endif
+		event.time = time_us_64 ();						// the synth plays the change at the matching sample
+		if (!event_ring_push (&event)) {
+			printf("Event ring is full.\n");
+			return false;
+		}
+	}
 
 	// Send program change on channel in case instrument has changed, or at the very start of the program
-	if ((force_instrument) || (instrument != former_instrument)) {
+	uint8_t pgm_change[4] = { (cable_num << 4) | CIN_PGMCHANGE, MIDI_PGMCHANGE | CHANNEL, 0, 0};
+	if (program) {
 		force_instrument = false;
 		pgm_change[2] = (uint8_t) (instrument & 0x7F);
 		tud_midi_packet_write (pgm_change);			// send to USB
-
-		if (!queue_try_add(&synth_queue, data)) {	// send to synth
-			printf("Queue is full.\n");
-		}
 	}
 
 	// send notes off events
 	uint8_t note_off[4] = { (cable_num << 4) | CIN_NOTEOFF, MIDI_NOTEOFF | CHANNEL, 0, 0 };
-	data = (uint32_t *) note_off;			// assign 32-bit data as 4 bytes of 8-bit
 
 	// Send Note Off at no velocity (0) on channel.
-	for (i=0; i<midi_notes_off_size; i++) {
-		note_off[2] = midi_notes_off [i];
+	for (i = noteset_next (&midi_notes_off, 0); i >= 0; i = noteset_next (&midi_notes_off, i + 1)) {
+		note_off[2] = (uint8_t) i;
 		note_off[3] = 0x00;
 		tud_midi_packet_write (note_off);			// send to USB
-
-		if (!queue_try_add(&synth_queue, data)) {	// send to synth
-			printf("Queue is full.\n");
-		}
 	}
 
 	// send notes off events
 	uint8_t note_on[4] = { (cable_num << 4) | CIN_NOTEON, MIDI_NOTEON | CHANNEL, 0, 127 };
-	data = (uint32_t *) note_on;			// assign 32-bit data as 4 bytes of 8-bit
 
 	// Send Note On at full velocity (127) on channel.
-	for (i=0; i<midi_notes_on_size; i++) {
-		note_on[2] = midi_notes_on [i];
+	for (i = noteset_next (&midi_notes_on, 0); i >= 0; i = noteset_next (&midi_notes_on, i + 1)) {
+		note_on[2] = (uint8_t) i;
 		note_on[3] = 0x7F;
 		tud_midi_packet_write (note_on);			// send to USB
-
-		if (!queue_try_add(&synth_queue, data)) {	// send to synth
-			printf("Queue is full.\n");
-		}
 	}
-}
 
+	return true;
+}
@@ -0,0 +1,104 @@
+#include "pico/stdlib.h"
+#include <stdint.h>
+#include <stdio.h>
+
+#include "globals.h"
+#include "synth.h"
+#include "voice_alloc.h"
+
+
+static uint8_t free_list[CHANNEL_COUNT];        // free channels; the last one of the list is the next to be used
+static uint8_t free_pos[CHANNEL_COUNT];         // position of each free channel in free_list
+static int free_count = 0;                      // number of free channels
+static uint32_t channel_age[CHANNEL_COUNT];     // value of note_counter when the channel started its current note
+static uint32_t note_counter = 0;               // incremented each time a channel starts or restarts a note
+static StealPolicy steal_policy = STEAL_RELEASING;
+
+
+// set all the channels as free: to be called when all the channels are off
+void init_voices() {
+    for (int c = 0; c < CHANNEL_COUNT; c++) {
+        // channel 0 is put last, so it is used first
+        free_list [c] = CHANNEL_COUNT - 1 - c;
+        free_pos [CHANNEL_COUNT - 1 - c] = c;
+    }
+    free_count = CHANNEL_COUNT;
+}
+
+// get a free channel, or NO_CHANNEL if all channels are busy
+// the channel stays in the free list until it actually starts playing (see channel_taken())
+int get_free_channel() {
+    return (free_count > 0) ? free_list [free_count - 1] : NO_CHANNEL;
+}
+
+// a channel becomes active: remove it from the free list
+void channel_taken(int c) {
+    channel_renewed (c);
+
+    int pos = free_pos [c];
+    if ((pos >= free_count) || (free_list [pos] != c)) return;  // not in the free list
+    int last = free_list [--free_count];
+    free_list [pos] = last;
+    free_pos [last] = pos;
+}
+
+// a channel which is active already starts a note again (stolen channel playing its pending note, retriggered note):
+// it is the most recent channel again, so that it is not the next one to be stolen
+void channel_renewed(int c) {
+    channel_age [c] = note_counter++;
+}
+
+// a channel goes off: give it back to the free list
+void channel_freed(int c) {
+    int pos = free_pos [c];
+    if ((pos < free_count) && (free_list [pos] == c)) return;   // in the free list already
+    free_pos [c] = free_count;
+    free_list [free_count++] = c;
+}
+
+// true if channel c started its note before channel other (or if other is NO_CHANNEL)
+// age is compared relative to note_counter, so this works when note_counter wraps around
+static bool is_older(int c, int other) {
+    return (other == NO_CHANNEL) || ((note_counter - channel_age [c]) > (note_counter - channel_age [other]));
+}
+
+// choose the channel to be stolen when all the channels are busy, based on the stealing policy
+// channels that are already fading out for another note are only stolen if there is nothing else
+int choose_stolen_channel() {
+    int best = NO_CHANNEL;
+    int best_releasing = NO_CHANNEL;
+    int best_pending = NO_CHANNEL;
+
+    for (int i = 0; i < active_count; i++) {
+        int c = active_list [i];
+        AudioChannel* channel = &channels[c];
+
+        if (channel->note_pending) {
+            if (is_older (c, best_pending)) best_pending = c;
+            continue;
+        }
+
+        switch (steal_policy) {
+            case STEAL_QUIETEST:
+                if ((best == NO_CHANNEL) || (channel->adsr < channels[best].adsr)) best = c;
+                break;
+            case STEAL_RELEASING:
+                if ((channel->adsr_phase == ADSR_RELEASE) && ((best_releasing == NO_CHANNEL) || (channel->adsr < channels[best_releasing].adsr))) best_releasing = c;
+                if (is_older (c, best)) best = c;       // oldest channel is the fallback
+                break;
+            case STEAL_OLDEST:
+            default:
+                if (is_older (c, best)) best = c;
+                break;
+        }
+    }
+
+    if (best_releasing != NO_CHANNEL) return best_releasing;
+    if (best != NO_CHANNEL) return best;
+    return best_pending;
+}
+
+// select how channels are stolen
+void set_steal_policy(StealPolicy policy) {
+    steal_policy = policy;
+}
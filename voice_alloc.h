@@ -0,0 +1,32 @@
+#ifndef VOICE_ALLOC_H
+#define VOICE_ALLOC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "pico/stdlib.h"
+
+
+// Voice allocator: keeps the list of free channels, and chooses which channel to steal when all channels are busy
+//
+// - free channels are kept in a list (stack), so getting a free channel is O(1)
+// - channels are taken / given back by synth.c when they become active / go off, so the list is always in line with the channels
+// - when no channel is free, a busy channel is stolen based on the stealing policy; the stolen channel fades out
+//   quickly (STEAL_FADE_MS) before playing the new note, instead of being cut (which makes a click)
+
+#define STEAL_FADE_MS 5           // fade-out duration of a stolen channel
+
+typedef enum {
+    STEAL_OLDEST,                 // steal the channel whose note was started first
+    STEAL_QUIETEST,               // steal the channel with the lowest ADSR volume
+    STEAL_RELEASING               // steal a channel in release phase first (quietest one), else the oldest channel
+} StealPolicy;
+
+void init_voices(void);
+int get_free_channel(void);
+void channel_taken(int);
+void channel_renewed(int);
+void channel_freed(int);
+int choose_stolen_channel(void);
+void set_steal_policy(StealPolicy);
+
+#endif // VOICE_ALLOC_H
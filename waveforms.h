@@ -4,26 +4,53 @@
 // Number of instruments
 #define NB_INSTRUMENTS 43
 
-// table of frequencies : this is the note frequency based on its midi number (0 to 127)
-const float frequencies[] = {
-    8.176, 8.662, 9.177, 9.723, 10.301, 10.913, 11.562, 12.250,
-    12.978, 13.750, 14.568, 15.434, 16.352, 17.324, 18.354, 19.445,
-    20.602, 21.827, 23.125, 24.500, 25.957, 27.500, 29.135, 30.868,
-    32.703, 34.648, 36.708, 38.891, 41.203, 43.654, 46.249, 48.999,
-    51.913, 55.000, 58.270, 61.735, 65.406, 69.296, 73.416, 77.782,
-    82.407, 87.307, 92.499, 97.999, 103.826, 110.000, 116.541, 123.471,
-    130.813, 138.591, 146.832, 155.563, 164.814, 174.614, 184.997, 195.998,
-    207.652, 220.000, 233.082, 246.942, 261.626, 277.183, 293.665, 311.127,
-    329.628, 349.228, 369.994, 391.995, 415.305, 440.000, 466.164, 493.883,
-    523.251, 554.365, 587.330, 622.254, 659.255, 698.456, 739.989, 783.991,
-    830.609, 880.000, 932.328, 987.767, 1046.502, 1108.731, 1174.659, 1244.508,
-    1318.510, 1396.913, 1479.978, 1567.982, 1661.219, 1760.000, 1864.655, 1975.533,
-    2093.005, 2217.461, 2349.318, 2489.016, 2637.020, 2793.826, 2959.955, 3135.963,
-    3322.438, 3520.000, 3729.310, 3951.066, 4186.009, 4434.922, 4698.636, 4978.032,
-    5274.041, 5587.652, 5919.911, 6271.927, 6644.875, 7040.000, 7458.620, 7902.133,
-    8372.018, 8869.844, 9397.273, 9956.063, 10548.080, 11175.300, 11839.820, 12543.850
+// table of phase increments : this is the per-sample phase step of a note based on its midi number (0 to 127), at 44100Hz sample rate
+// phase is on 32-bit and wraps around one waveform period: the top 8 bits index the 256-sample waveform (Q8.24)
+// values are computed from equal temperament (A3 = midi note 69 = 440Hz) as round (440 * 2^((note-69)/12) * 2^32 / 44100)
+const uint32_t phase_increments[] = {
+    796254, 843601, 893765, 946911, 1003217, 1062871, 1126073, 1193033,
+    1263974, 1339134, 1418763, 1503127, 1592507, 1687203, 1787529, 1893821,
+    2006434, 2125742, 2252146, 2386065, 2527948, 2678268, 2837526, 3006254,
+    3185015, 3374406, 3575058, 3787642, 4012867, 4251485, 4504291, 4772130,
+    5055896, 5356535, 5675051, 6012507, 6370030, 6748811, 7150117, 7575285,
+    8025735, 8502970, 9008582, 9544261, 10111792, 10713070, 11350103, 12025015,
+    12740059, 13497623, 14300233, 15150569, 16051469, 17005939, 18017165, 19088521,
+    20223584, 21426141, 22700205, 24050030, 25480119, 26995246, 28600467, 30301139,
+    32102938, 34011878, 36034330, 38177043, 40447168, 42852281, 45400411, 48100060,
+    50960238, 53990491, 57200933, 60602278, 64205876, 68023757, 72068660, 76354085,
+    80894335, 85704563, 90800821, 96200119, 101920476, 107980983, 114401866, 121204555,
+    128411753, 136047513, 144137319, 152708170, 161788671, 171409126, 181601643, 192400238,
+    203840952, 215961966, 228803732, 242409110, 256823506, 272095026, 288274639, 305416341,
+    323577341, 342818251, 363203285, 384800477, 407681904, 431923931, 457607465, 484818220,
+    513647012, 544190053, 576549277, 610832681, 647154683, 685636503, 726406571, 769600953,
+    815363807, 863847862, 915214929, 969636441, 1027294024, 1088380105, 1153098554, 1221665363
 };
 
+// waveform used to play each midi note (0 to 127), among the 8 waveforms of an instrument
+// there are different waveforms so that higher notes get less harmonics than lower range notes (waveforms are simpler)
+// this is a design characteristic of Korg DW8000 synthetizer
+// each line of note_waveforms is a set of split points; an instrument uses the set given in instrument_splits (set 0 by default)
+// so an instrument with other split points only requires a new set here
+#define NB_SPLITS 1
+const uint8_t note_waveforms[NB_SPLITS][128] = {
+	{											// set 0: DW8000 octaves
+		0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,     // notes 0-11 (C-2)
+		0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,     // notes 12-23 (C-1)
+		0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,     // notes 24-35 (C0)
+		1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,     // notes 36-47 (C1)
+		2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,     // notes 48-59 (C2)
+		3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3,     // notes 60-71 (C3)
+		4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,     // notes 72-83 (C4)
+		5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5,     // notes 84-95 (C5)
+		6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,     // notes 96-107 (C6)
+		7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,     // notes 108-119 (C7)
+		7, 7, 7, 7, 7, 7, 7, 7                  // notes 120-127 (C8)
+	}
+};
+
+// set of split points used by each instrument (index in note_waveforms)
+const uint8_t instrument_splits[64] = {0};
+
 // attack in ms, decay in ms, sustain volume (0xffff = 100% of max volume; 0xafff = 70% of the volume), sustain in ms,
 // release in ms, channel volume (set at 0x7fff, ie.50% of max volume to avoid saturation; it can be up to 0xffff)
 const uint32_t instruments[64][6] = {